@@ -1,15 +1,23 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <fstream>
+#include <functional>
+#include <list>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <queue>
 #include <set>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -203,8 +211,62 @@ public:
 
 namespace kdtree {
 
-class PointSet
+//compares along the splitting axis (x when true), ties are broken by the other coordinate
+bool less(const Point & a, const Point & b, bool axis);
+
+// a split policy reorders the points of a subtree and returns how many of them go to the left child; the left ones
+// have to be less than the rest along the axis it picks, which comes in as the alternating one
+// `axis(leaf, point, depth)` picks the axis put() splits a full leaf on when a new point lands in it, given
+// the first point of the leaf
+
+// halves the points along the alternating axis
+struct MedianSplit
+{
+    static std::size_t split(std::vector<Point>::iterator first, std::vector<Point>::iterator last, bool & axis);
+    static bool axis(const Point & leaf, const Point & point, bool depth);
+};
+
+// cuts the longer side of the bounding box in the middle, sliding the cut to the nearest point when one side is empty;
+// empty space ends up in few big boxes instead of stretching the boxes of the clusters
+struct SlidingMidpointSplit
 {
+    static std::size_t split(std::vector<Point>::iterator first, std::vector<Point>::iterator last, bool & axis);
+    static bool axis(const Point & leaf, const Point & point, bool depth);
+};
+
+// halves the points along the axis they spread wider on
+struct WidestSpreadSplit
+{
+    static std::size_t split(std::vector<Point>::iterator first, std::vector<Point>::iterator last, bool & axis);
+    static bool axis(const Point & leaf, const Point & point, bool depth);
+};
+
+// picks the axis and the cut that minimize the half-perimeters of both boxes weighted by their point counts, which is
+// what a small query pays for visiting them; the cut stays within the middle half of the points to bound the depth
+struct CostSplit
+{
+    static std::size_t split(std::vector<Point>::iterator first, std::vector<Point>::iterator last, bool & axis);
+    static bool axis(const Point & leaf, const Point & point, bool depth);
+};
+
+template <typename Split>
+class BasicPointSet
+{
+public:
+    // what the points of a subtree add up to
+    struct Summary
+    {
+        std::size_t count = 0;
+        double sum_x = 0;
+        double sum_y = 0;
+        double weight = 0;
+
+        friend Summary operator+(const Summary & lhs, const Summary & rhs)
+        {
+            return {lhs.count + rhs.count, lhs.sum_x + rhs.sum_x, lhs.sum_y + rhs.sum_y, lhs.weight + rhs.weight};
+        }
+    };
+
 private:
     struct Node
     {
@@ -212,7 +274,15 @@ private:
         std::shared_ptr<Node> right;
         std::weak_ptr<Node> parent;
         Rect region;
+        // the split key of an inner node, the greatest point of its left subtree; a leaf keeps its first point here
+        // with its weight and the others in `rest`, so that a leaf of one point needs nothing more
         Point data;
+        double weight = 1;
+        std::vector<std::pair<Point, double>> rest;
+        // a leaf sums up its points, an inner node its children
+        Summary summary;
+        // the axis an inner node splits on, x when true; kept in the node since erase() moves subtrees one level up
+        bool depth = true;
 
         Node(Point given_data, Rect given_region, std::shared_ptr<Node> given_left, std::shared_ptr<Node> given_right, const std::shared_ptr<Node> & given_parent)
             : left(std::move(given_left))
@@ -220,7 +290,70 @@ private:
             , parent(given_parent)
             , region(given_region)
             , data(given_data)
+            , summary(left->summary + right->summary)
+        {
+        }
+
+        Node(Point given_data, double given_weight)
+            : region(given_data, given_data)
+            , data(given_data)
+            , weight(given_weight)
+            , summary{1, data.x(), data.y(), weight}
+        {
+        }
+
+        // the points of a leaf, in no particular order
+        std::size_t count() const
+        {
+            return rest.size() + 1;
+        }
+
+        const Point & point(std::size_t i) const
+        {
+            return (i == 0 ? data : rest[i - 1].first);
+        }
+
+        Point & point(std::size_t i)
+        {
+            return (i == 0 ? data : rest[i - 1].first);
+        }
+
+        double & weight_of(std::size_t i)
         {
+            return (i == 0 ? weight : rest[i - 1].second);
+        }
+
+        std::size_t index_of(const Point & given_point) const
+        {
+            std::size_t i = 0;
+            while (i < count() && point(i) != given_point) {
+                ++i;
+            }
+            return i;
+        }
+
+        // the last point takes the place of the removed one; a leaf keeps at least one point
+        void remove(std::size_t i)
+        {
+            point(i) = rest.back().first;
+            weight_of(i) = rest.back().second;
+            rest.pop_back();
+        }
+
+        // rebuilds the box and the sums of a leaf from its points
+        void refresh()
+        {
+            double xmin = data.x(), ymin = data.y();
+            double xmax = xmin, ymax = ymin;
+            summary = {1, data.x(), data.y(), weight};
+            for (const auto & [rest_point, rest_weight] : rest) {
+                xmin = std::min(xmin, rest_point.x());
+                ymin = std::min(ymin, rest_point.y());
+                xmax = std::max(xmax, rest_point.x());
+                ymax = std::max(ymax, rest_point.y());
+                summary = summary + Summary{1, rest_point.x(), rest_point.y(), rest_weight};
+            }
+            region = Rect(Point(xmin, ymin), Point(xmax, ymax));
         }
     };
 
@@ -228,6 +361,7 @@ private:
     std::shared_ptr<Node> end_pointer;
     std::shared_ptr<Node> root;
     std::size_t m_size = 0;
+    std::size_t m_leaf_size = 1;
 
     static void report_subtree(const std::shared_ptr<Node> & cur, const std::shared_ptr<std::vector<Point>> & result);
     static void search_range_child(const std::shared_ptr<Node> & child, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result);
@@ -241,27 +375,52 @@ private:
 
     std::shared_ptr<Node> next(std::shared_ptr<Node> cur) const;
 
-    static Point nearest_impl(const std::shared_ptr<Node> & cur, const Point & point, double min);
-    static void nearest_impl(const std::shared_ptr<Node> & cur, const Point & point, std::size_t k, std::shared_ptr<std::vector<std::pair<double, Point>>> & heap);
+    static void nearest_impl(const std::shared_ptr<Node> & cur, const Point & point, Point & best, double & min);
+    static void nearest_impl(const std::shared_ptr<Node> & cur, const Point & point, std::size_t k, const Rect * clip, const std::function<bool(const Point &)> & filter, std::vector<std::pair<double, Point>> & heap);
     static void search_range(const std::shared_ptr<Node> & cur, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result);
+    static Summary summarize(const std::shared_ptr<Node> & cur, const Rect & rect);
+    static double box_cost(const std::shared_ptr<Node> & cur, double width, double height);
+    static void search_range_multi(const std::shared_ptr<Node> & cur, const std::vector<std::array<double, 4>> & rects, std::vector<std::size_t>::iterator first, std::vector<std::size_t>::iterator last, const std::vector<std::shared_ptr<std::vector<Point>>> & results);
+    static void search_range_multi_child(const std::shared_ptr<Node> & child, const std::vector<std::array<double, 4>> & rects, std::vector<std::size_t>::iterator first, std::vector<std::size_t>::iterator last, const std::vector<std::shared_ptr<std::vector<Point>>> & results);
+
+    // exact coordinates, as routing compares them; the sign of zero is dropped
+    struct point_hash
+    {
+        std::size_t operator()(const Point & p) const
+        {
+            return std::hash<double>()(p.x() + 0.0) * 0x9E3779B97F4A7C15ULL ^ std::hash<double>()(p.y() + 0.0);
+        }
+    };
+
+    static void collect(const std::shared_ptr<Node> & cur, const BasicPointSet * skip, std::vector<Point> & points, std::unordered_map<Point, double, point_hash> & weights);
+    static Summary assign_weights(const std::shared_ptr<Node> & cur, const std::unordered_map<Point, double, point_hash> & weights);
+    // the points of a go left, so every one of them has to be less than those of b along the axis
+    static std::shared_ptr<Node> join(std::shared_ptr<Node> a, std::shared_ptr<Node> b, const Point & key, bool axis);
+    static std::pair<std::shared_ptr<Node>, std::shared_ptr<Node>> split_impl(const std::shared_ptr<Node> & cur, bool axis, double value, bool inclusive);
+    static BasicPointSet adopt(std::shared_ptr<Node> root, std::size_t leaf_size);
 
     void constructor_impl(std::vector<Point> input);
-    static std::shared_ptr<Node> build_tree(std::vector<Point>::iterator start, std::vector<Point>::iterator finish, bool depth);
+    static std::shared_ptr<Node> build_tree(std::vector<Point>::iterator start, std::vector<Point>::iterator finish, bool depth, std::size_t leaf_size);
 
 public:
-    PointSet(const std::string & filename = {});
+    // a leaf holds up to `leaf_size` points, at least one; bigger leaves mean fewer nodes and shallower walks, but
+    // their points are checked one by one
+    BasicPointSet(const std::string & filename = {}, std::size_t leaf_size = 1);
+    explicit BasicPointSet(std::vector<Point> points, std::size_t leaf_size = 1);
 
     class iterator
     {
         using node_ptr = std::shared_ptr<Node>;
         using vector_iterator = std::vector<Point>::iterator;
         using heap_iterator = std::vector<std::pair<double, Point>>::iterator;
-        using set_ptr = const PointSet *;
+        using set_ptr = const BasicPointSet *;
         using vector_ptr = std::shared_ptr<std::vector<Point>>;
         using heap_ptr = std::shared_ptr<std::vector<std::pair<double, Point>>>;
 
         std::variant<node_ptr, vector_iterator, heap_iterator> m_current = nullptr;
         std::variant<vector_ptr, set_ptr, heap_ptr> m_tree;
+        // the position within the current leaf
+        std::size_t m_index = 0;
 
         bool range() const
         {
@@ -302,7 +461,7 @@ public:
 
         friend bool operator==(const iterator & lhs, const iterator & rhs)
         {
-            return lhs.m_tree == rhs.m_tree && lhs.m_current == rhs.m_current;
+            return lhs.m_tree == rhs.m_tree && lhs.m_current == rhs.m_current && lhs.m_index == rhs.m_index;
         }
 
         friend bool operator!=(const iterator & lhs, const iterator & rhs)
@@ -318,7 +477,7 @@ public:
             if (nearest()) {
                 return &std::get<heap_iterator>(m_current)->second;
             }
-            return &std::get<node_ptr>(m_current)->data;
+            return &std::get<node_ptr>(m_current)->point(m_index);
         }
 
         reference operator*() const
@@ -329,7 +488,7 @@ public:
             if (nearest()) {
                 return std::get<heap_iterator>(m_current)->second;
             }
-            return std::get<node_ptr>(m_current)->data;
+            return std::get<node_ptr>(m_current)->point(m_index);
         }
 
         iterator & operator++()
@@ -340,8 +499,246 @@ public:
             else if (nearest()) {
                 ++std::get<heap_iterator>(m_current);
             }
-            else {
+            else if (++m_index == std::get<node_ptr>(m_current)->count()) {
                 std::get<node_ptr>(m_current) = std::get<set_ptr>(m_tree)->next(std::get<node_ptr>(m_current));
+                m_index = 0;
+            }
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            auto tmp = *this;
+            operator++();
+            return tmp;
+        }
+    };
+
+    bool empty() const;
+    std::size_t size() const;
+    std::size_t leaf_size() const;
+    // bounding box of all the points, empty for an empty set
+    std::optional<Rect> bounds() const;
+    // the weight only counts in sum_weights() and is kept by the first put of a point
+    void put(const Point & point, double weight = 1);
+    bool contains(const Point & point) const;
+    // both return false when there is no such point; the boxes on the path are rebuilt, so they stay tight
+    bool erase(const Point & point);
+    // a point staying in the cell of its leaf is rewritten in place, otherwise it is erased and put again;
+    // moving onto another point of the set merges them
+    bool move(const Point & from, const Point & to);
+    // a whole tick of moves, applied in z-order of their sources so that neighbouring moves share the cached path;
+    // returns how many sources were found
+    std::size_t move(std::vector<std::pair<Point, Point>> moves);
+
+    // both sets are consumed and their points rebuilt into one balanced tree; a point of b already in a is dropped,
+    // so it keeps its weight from a, and the result takes the leaf size of a. Nothing is sorted as a whole, but each
+    // point of b costs a lookup in a, O(log n), and the rebuild partitions every level, so a merge is O(n log n)
+    // like building the union from scratch
+    static BasicPointSet merge(BasicPointSet && a, BasicPointSet && b);
+    // the set is consumed; the first set gets the points whose coordinate along the axis (x when true) is below
+    // the value, subtrees lying on one side are moved over as they are
+    static std::pair<BasicPointSet, BasicPointSet> split_at(BasicPointSet && set, bool axis, double value);
+    // the set is consumed; the first set gets the points inside the rectangle, the second one all the rest
+    static std::pair<BasicPointSet, BasicPointSet> split(BasicPointSet && set, const Rect & rect);
+
+    // the aggregates stop at the subtrees lying inside the rectangle instead of reporting their points
+    Summary summarize(const Rect & rect) const;
+    std::size_t count(const Rect & rect) const;
+    double sum_weights(const Rect & rect) const;
+    // mean of the points inside the rectangle, empty when there are none
+    std::optional<Point> centroid(const Rect & rect) const;
+    // how many boxes a range query of the given size checks on average when it is placed uniformly over the bounds;
+    // a leaf counts as one box however many points it holds
+    double expected_cost(double width, double height) const;
+
+    std::pair<iterator, iterator> range(const Rect & rect) const;
+    // answers all the rectangles in one walk over the tree, the i-th pair of iterators belongs to the i-th rectangle
+    std::vector<std::pair<iterator, iterator>> range_multi(const std::vector<Rect> & rects) const;
+    iterator begin() const;
+    iterator end() const;
+
+    std::optional<Point> nearest(const Point & point) const;
+    std::pair<iterator, iterator> nearest(const Point & p, std::size_t k) const;
+    // only the points inside the clip and accepted by the filter count, an empty filter accepts everything;
+    // subtrees outside the clip are never entered
+    std::optional<Point> nearest(const Point & point, const Rect & clip, const std::function<bool(const Point &)> & filter = {}) const;
+    std::optional<Point> nearest(const Point & point, const std::function<bool(const Point &)> & filter) const;
+    std::pair<iterator, iterator> nearest(const Point & p, std::size_t k, const Rect & clip, const std::function<bool(const Point &)> & filter = {}) const;
+    std::pair<iterator, iterator> nearest(const Point & p, std::size_t k, const std::function<bool(const Point &)> & filter) const;
+
+    friend std::ostream & operator<<(std::ostream & stream, const BasicPointSet & set)
+    {
+        for (auto iter = set.begin(); iter != set.end(); iter++) {
+            stream << *iter << "; ";
+        }
+        return stream;
+    }
+};
+
+using PointSet = BasicPointSet<MedianSplit>;
+
+// k nearest points over the parts of a container built of several trees: `bounds(i)` gives the bounds of part i,
+// empty when it has no points, and `nearest(i, k)` its own k nearest points. Parts are searched closest first and
+// the rest are cut off by their bounds; when parts may share points, a point found twice is reported once
+std::pair<PointSet::iterator, PointSet::iterator> nearest_of_parts(
+        const Point & p,
+        std::size_t k,
+        std::size_t parts,
+        bool shared,
+        const std::function<std::optional<Rect>(std::size_t)> & bounds,
+        const std::function<std::pair<PointSet::iterator, PointSet::iterator>(std::size_t, std::size_t)> & nearest);
+
+} // namespace kdtree
+
+namespace grid {
+
+// uniform grid hashed by cell; the cell size is tuned on growth to the extent the bulk of the points occupies and
+// to how full the occupied cells come out, so a few far-off points do not pile the rest into one cell
+class PointSet
+{
+private:
+    using cell = std::pair<std::int64_t, std::int64_t>;
+
+    struct cell_hash
+    {
+        std::size_t operator()(const cell & c) const
+        {
+            return std::hash<std::int64_t>()(c.first * 0x9E3779B97F4A7C15ULL ^ c.second);
+        }
+    };
+
+    // how many points a cell is expected to hold after a rebuild
+    static constexpr double points_per_cell = 2;
+    // a rebuild halves the cells, at most max_refinements times, while the occupied ones hold more than this many
+    // points on average
+    static constexpr double crowded_cell = 8 * points_per_cell;
+    static constexpr int max_refinements = 32;
+    // a put into a cell growing past this many points, or twice the fullest cell of the last rebuild, rebuilds
+    static constexpr std::size_t overfull_cell = 32 * static_cast<std::size_t>(points_per_cell);
+    // cell indices stay within this bound, so distances between them never overflow
+    static constexpr double max_cell_index = 1LL << 60;
+
+    std::vector<Point> m_points;
+    std::unordered_map<cell, std::vector<Point>, cell_hash> m_cells;
+    std::optional<Rect> m_bounds;
+    Point m_origin{0, 0};
+    double m_cell_size = 1;
+    std::size_t m_rebuild_at = 16;
+    std::size_t m_overfull_at = overfull_cell;
+
+    cell cell_of(const Point & point) const;
+    const std::vector<Point> * find_cell(const cell & c) const;
+    // the side of a cell for the extent the points occupy once the farthest few percent are left out
+    double occupied_cell_size() const;
+    void rehash();
+    void rebuild();
+    // the first and the last rings around the center that contain occupied cells
+    std::pair<std::int64_t, std::int64_t> rings(const cell & center) const;
+
+    // visits the cells at the given chebyshev distance from the center, clipped by the occupied cells
+    template <typename F>
+    void for_each_in_ring(const cell & center, std::int64_t radius, F && f) const;
+    // how many cells for_each_in_ring() looks up
+    double ring_size(const cell & center, std::int64_t radius) const;
+    // feeds f the points around the center ring by ring, until `done(radius)` says nothing farther than that ring
+    // can matter; once the rings have looked up a quarter as many cells as are occupied, the points outside them
+    // are checked directly, so empty space between far-off points costs no more than a scan
+    template <typename F, typename Done>
+    void search_around(const cell & center, F && f, Done && done) const;
+
+public:
+    class iterator
+    {
+        using points_iterator = std::vector<Point>::const_iterator;
+        using vector_iterator = std::vector<Point>::iterator;
+        using heap_iterator = std::vector<std::pair<double, Point>>::iterator;
+        using set_ptr = const PointSet *;
+        using vector_ptr = std::shared_ptr<std::vector<Point>>;
+        using heap_ptr = std::shared_ptr<std::vector<std::pair<double, Point>>>;
+
+        std::variant<points_iterator, vector_iterator, heap_iterator> m_current;
+        std::variant<vector_ptr, set_ptr, heap_ptr> m_set;
+
+        bool range() const
+        {
+            return std::holds_alternative<vector_iterator>(m_current);
+        }
+
+        bool nearest() const
+        {
+            return std::holds_alternative<heap_iterator>(m_current);
+        }
+
+    public:
+        using value_type = Point;
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Point *;
+        using reference = const Point &;
+
+        iterator(set_ptr given_m_set, points_iterator given_m_current)
+            : m_current(given_m_current)
+            , m_set(given_m_set)
+        {
+        }
+
+        iterator(vector_ptr given_m_set, vector_iterator given_m_current)
+            : m_current(given_m_current)
+            , m_set(std::move(given_m_set))
+        {
+        }
+
+        iterator(heap_ptr given_m_set, heap_iterator given_m_current)
+            : m_current(given_m_current)
+            , m_set(std::move(given_m_set))
+        {
+        }
+
+        iterator() = default;
+
+        friend bool operator==(const iterator & lhs, const iterator & rhs)
+        {
+            return lhs.m_set == rhs.m_set && lhs.m_current == rhs.m_current;
+        }
+
+        friend bool operator!=(const iterator & lhs, const iterator & rhs)
+        {
+            return !(lhs == rhs);
+        }
+
+        pointer operator->() const
+        {
+            if (range()) {
+                return &*std::get<vector_iterator>(m_current);
+            }
+            if (nearest()) {
+                return &std::get<heap_iterator>(m_current)->second;
+            }
+            return &*std::get<points_iterator>(m_current);
+        }
+
+        reference operator*() const
+        {
+            if (range()) {
+                return *std::get<vector_iterator>(m_current);
+            }
+            if (nearest()) {
+                return std::get<heap_iterator>(m_current)->second;
+            }
+            return *std::get<points_iterator>(m_current);
+        }
+
+        iterator & operator++()
+        {
+            if (range()) {
+                ++std::get<vector_iterator>(m_current);
+            }
+            else if (nearest()) {
+                ++std::get<heap_iterator>(m_current);
+            }
+            else {
+                ++std::get<points_iterator>(m_current);
             }
             return *this;
         }
@@ -354,16 +751,21 @@ public:
         }
     };
 
+    PointSet(const std::string & filename = {});
+
     bool empty() const;
     std::size_t size() const;
     void put(const Point & point);
     bool contains(const Point & point) const;
 
+    // second iterator points to an element out of range
     std::pair<iterator, iterator> range(const Rect & rect) const;
+    // points are iterated in the order of insertion
     iterator begin() const;
     iterator end() const;
 
     std::optional<Point> nearest(const Point & point) const;
+    // second iterator points to an element out of range
     std::pair<iterator, iterator> nearest(const Point & p, std::size_t k) const;
 
     friend std::ostream & operator<<(std::ostream & stream, const PointSet & set)
@@ -375,4 +777,268 @@ public:
     }
 };
 
-} // namespace kdtree
+} // namespace grid
+
+namespace sharded {
+
+// the plane is cut into a grid of independent kd-trees, each one guarded by its own lock,
+// so that writers hitting different shards do not wait for each other
+class PointSet
+{
+private:
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        kdtree::PointSet set;
+    };
+
+    Rect m_bounds;
+    std::size_t m_columns;
+    std::size_t m_rows;
+    std::vector<Shard> m_shards;
+    std::atomic<std::size_t> m_size = 0;
+
+    // points outside of the grid bounds go to the closest border shard
+    std::size_t shard_index(const Point & point) const;
+
+public:
+    using iterator = kdtree::PointSet::iterator;
+
+    PointSet(const Rect & bounds, std::size_t columns = 4, std::size_t rows = 4, const std::string & filename = {});
+
+    bool empty() const;
+    std::size_t size() const;
+    void put(const Point & point);
+    bool contains(const Point & point) const;
+
+    // every shard is locked separately, so the result is not a snapshot of the whole set
+    std::pair<iterator, iterator> range(const Rect & rect) const;
+    std::pair<iterator, iterator> points() const;
+
+    std::optional<Point> nearest(const Point & point) const;
+    std::pair<iterator, iterator> nearest(const Point & p, std::size_t k) const;
+
+    friend std::ostream & operator<<(std::ostream & stream, const PointSet & set)
+    {
+        auto [first, last] = set.points();
+        for (auto iter = first; iter != last; iter++) {
+            stream << *iter << "; ";
+        }
+        return stream;
+    }
+};
+
+} // namespace sharded
+
+namespace window {
+
+// keeps the points of the last few intervals in a ring of kd-trees, one per interval; the newest interval takes
+// the puts, advance() rebuilds it balanced and drops the oldest one as a whole
+class PointSet
+{
+private:
+    std::vector<kdtree::PointSet> m_generations;
+    // the interval taking puts, the older ones follow it backwards around the ring
+    std::size_t m_current = 0;
+
+public:
+    using iterator = kdtree::PointSet::iterator;
+
+    explicit PointSet(std::size_t intervals = 1);
+
+    bool empty() const;
+    // a point put in several live intervals is counted in each of them
+    std::size_t size() const;
+    std::size_t intervals() const;
+    void put(const Point & point);
+    bool contains(const Point & point) const;
+    // seals the current interval and reuses the slot of the oldest one for the next
+    void advance();
+
+    // a point put in several live intervals is reported once
+    std::pair<iterator, iterator> range(const Rect & rect) const;
+    std::pair<iterator, iterator> points() const;
+
+    std::optional<Point> nearest(const Point & point) const;
+    std::pair<iterator, iterator> nearest(const Point & p, std::size_t k) const;
+
+    friend std::ostream & operator<<(std::ostream & stream, const PointSet & set)
+    {
+        auto [first, last] = set.points();
+        for (auto iter = first; iter != last; iter++) {
+            stream << *iter << "; ";
+        }
+        return stream;
+    }
+};
+
+} // namespace window
+
+namespace compact {
+
+// static kd-tree for large sets: nodes are kept in an implicit array and hold nothing but their bounding box,
+// written as fixed-point offsets inside the box of the parent; points are split into a quantized copy
+// walked by queries and an exact copy read only to re-check candidates and to report results.
+// The exact copy stays in memory unless a file is given for it: then only the boxes and the codes are resident
+// and queries read the exact points from the file, so such a set is not safe to share between threads
+template <typename Offset>
+class PointSet
+{
+    static_assert(std::is_unsigned_v<Offset>, "offsets must be unsigned integers");
+
+private:
+    // how many points a leaf keeps at most
+    static constexpr std::size_t leaf_size = 8;
+    static constexpr Offset max_offset = std::numeric_limits<Offset>::max();
+
+    // offsets of xmin, ymin, xmax, ymax inside the parent box, rounded outwards
+    using Box = std::array<Offset, 4>;
+
+    std::vector<Box> m_nodes;
+    std::vector<std::array<Offset, 2>> m_codes;
+    // the exact copy, in the order of the codes: in memory, or in the file when it is open
+    std::vector<Point> m_points;
+    mutable std::ifstream m_exact;
+    std::size_t m_size = 0;
+    std::optional<Rect> m_bounds;
+    double m_error = 0;
+
+    static double decode(double min, double max, Offset code);
+    static Offset encode_down(double min, double max, double value);
+    static Offset encode_up(double min, double max, double value);
+    static Rect decode(const Rect & parent, const Box & box);
+    // the cell of a quantized point is guaranteed to contain the exact one
+    static Rect decode_cell(const Rect & leaf, const std::array<Offset, 2> & code);
+
+    void build(std::size_t node, std::size_t first, std::size_t count, const Rect & parent, bool depth);
+
+    Point exact(std::size_t index) const;
+    // appends the exact points first .. first + count to the result
+    void exact(std::size_t first, std::size_t count, std::vector<Point> & result) const;
+
+    bool contains_impl(std::size_t node, std::size_t first, std::size_t count, const Rect & box, const Point & point) const;
+    void search_range(std::size_t node, std::size_t first, std::size_t count, const Rect & box, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result) const;
+    void nearest_impl(std::size_t node, std::size_t first, std::size_t count, const Rect & box, const Point & point, std::size_t k, std::vector<std::pair<double, Point>> & heap) const;
+
+    void constructor_impl(std::vector<Point> input, const std::string & exact_file);
+
+public:
+    using iterator = kdtree::PointSet::iterator;
+
+    // exact_file, when given, is overwritten with the exact points, which are then read from it instead of memory
+    PointSet(const std::string & filename = {}, const std::string & exact_file = {});
+    explicit PointSet(std::vector<Point> points, const std::string & exact_file = {});
+
+    bool empty() const;
+    std::size_t size() const;
+    bool contains(const Point & point) const;
+
+    std::pair<iterator, iterator> range(const Rect & rect) const;
+
+    std::optional<Point> nearest(const Point & point) const;
+    std::pair<iterator, iterator> nearest(const Point & p, std::size_t k) const;
+
+    // the largest distance between a point and the corner of its quantized cell, along any axis
+    double error_bound() const;
+    // bytes of memory taken by the nodes and the points, not counting the object itself nor the exact file:
+    // about 22 per point with 16-bit offsets and 28 with 32-bit ones, 6 and 12 when the exact copy is in a file
+    std::size_t memory_usage() const;
+
+    friend std::ostream & operator<<(std::ostream & stream, const PointSet & set)
+    {
+        std::vector<Point> points;
+        set.exact(0, set.size(), points);
+        for (const Point & point : points) {
+            stream << point << "; ";
+        }
+        return stream;
+    }
+};
+
+} // namespace compact
+
+namespace paged {
+
+// kd-tree kept in a file and read through a bounded page cache, for sets that do not fit in memory;
+// build() writes the file, the set only reads it, so it is not safe to share between threads
+class PointSet
+{
+public:
+    static constexpr std::size_t page_size = 4096;
+
+    struct IoStats
+    {
+        std::size_t page_reads = 0;
+        std::size_t cache_hits = 0;
+    };
+
+private:
+    // a node of the file: a leaf has no children, every node knows the points of its subtree,
+    // which are stored contiguously in the point pages
+    struct Node
+    {
+        double xmin;
+        double ymin;
+        double xmax;
+        double ymax;
+        std::uint32_t left;
+        std::uint32_t right;
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        std::uint64_t size;
+        std::uint64_t node_pages;
+        std::uint32_t root;
+    };
+
+    static constexpr std::uint32_t no_child = std::numeric_limits<std::uint32_t>::max();
+    static constexpr std::size_t nodes_per_page = page_size / sizeof(Node);
+    static constexpr std::size_t points_per_page = page_size / (2 * sizeof(double));
+    static constexpr std::size_t leaf_size = 64;
+
+    class Builder;
+
+    mutable std::ifstream m_file;
+    Header m_header{};
+    std::size_t m_capacity;
+    mutable std::list<std::size_t> m_lru;
+    mutable std::unordered_map<std::size_t, std::pair<std::vector<char>, std::list<std::size_t>::iterator>> m_cache;
+    mutable IoStats m_stats;
+
+    const char * page(std::size_t index) const;
+    Node node(std::uint32_t id) const;
+    Point point(std::size_t index) const;
+    static Rect region(const Node & cur);
+
+    void report_subtree(const Node & cur, const std::shared_ptr<std::vector<Point>> & result) const;
+    void search_range(const Node & cur, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result) const;
+    bool contains_impl(const Node & cur, const Point & point) const;
+    void nearest_impl(const Node & cur, const Point & point, std::size_t k, std::vector<std::pair<double, Point>> & heap) const;
+
+public:
+    using iterator = kdtree::PointSet::iterator;
+
+    // reads the text file of points in a few passes, keeping at most memory_limit bytes of them in memory at once
+    static void build(const std::string & input, const std::string & output, std::size_t memory_limit);
+
+    // the cache holds at most memory_limit bytes of pages
+    PointSet(const std::string & filename, std::size_t memory_limit);
+
+    bool empty() const;
+    std::size_t size() const;
+    bool contains(const Point & point) const;
+
+    std::pair<iterator, iterator> range(const Rect & rect) const;
+
+    std::optional<Point> nearest(const Point & point) const;
+    std::pair<iterator, iterator> nearest(const Point & p, std::size_t k) const;
+
+    IoStats stats() const;
+    void reset_stats();
+};
+
+} // namespace paged
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "primitives.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// binary protocol of the point set server; both sides run on the same host, so numbers go in native byte order
+// a request is a RequestHeader followed by `length` bytes of arguments, a response is a ResponseHeader followed
+// by `length` bytes of results; requests may be pipelined, responses carry the id of their request
+namespace protocol {
+
+enum class Op : std::uint8_t
+{
+    put = 1,      // x, y -> nothing
+    contains = 2, // x, y -> std::uint8_t
+    range = 3,    // xmin, ymin, xmax, ymax -> points
+    nearest = 4,  // x, y -> points (none or one)
+    knn = 5,      // x, y, std::uint32_t k -> points
+};
+
+enum class Status : std::uint8_t
+{
+    ok = 0,
+    bad_request = 1,
+};
+
+struct RequestHeader
+{
+    std::uint32_t length;
+    std::uint32_t id;
+    Op op;
+    std::uint8_t reserved[3];
+};
+
+struct ResponseHeader
+{
+    std::uint32_t length;
+    std::uint32_t id;
+    Status status;
+    std::uint8_t reserved[3];
+};
+
+// a longer frame means the peer is broken, the connection is dropped
+constexpr std::uint32_t max_request_length = 64;
+
+template <typename T>
+void append(std::vector<char> & buffer, const T & value)
+{
+    const char * bytes = reinterpret_cast<const char *>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+// returns false when there are not enough bytes left
+template <typename T>
+bool extract(const char *& data, const char * end, T & value)
+{
+    if (static_cast<std::size_t>(end - data) < sizeof(T)) {
+        return false;
+    }
+    std::memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return true;
+}
+
+inline void append_request(std::vector<char> & buffer, std::uint32_t id, Op op, const std::vector<double> & args, std::optional<std::uint32_t> k = {})
+{
+    RequestHeader header{static_cast<std::uint32_t>(args.size() * sizeof(double) + (k ? sizeof(std::uint32_t) : 0)), id, op, {}};
+    append(buffer, header);
+    for (double arg : args) {
+        append(buffer, arg);
+    }
+    if (k) {
+        append(buffer, *k);
+    }
+}
+
+// points are written as a count followed by x, y pairs
+template <typename Iterator>
+void append_points(std::vector<char> & buffer, Iterator first, Iterator last)
+{
+    std::size_t count_at = buffer.size();
+    append(buffer, std::uint32_t(0));
+    std::uint32_t count = 0;
+    for (; first != last; ++first, ++count) {
+        append(buffer, first->x());
+        append(buffer, first->y());
+    }
+    std::memcpy(buffer.data() + count_at, &count, sizeof(count));
+}
+
+} // namespace protocol
@@ -3,57 +3,191 @@
 namespace kdtree {
 
 //constructing a tree from a vector provides a better balance than constructing it via multiple put operations
-void PointSet::constructor_impl(std::vector<Point> input) //NOLINT "input can have const qualifier" -- we change its order via std::unique
+template <typename Split>
+void BasicPointSet<Split>::constructor_impl(std::vector<Point> input) //NOLINT "input can have const qualifier" -- we change its order via std::unique
 {
     if (input.empty()) {
         return;
     }
+    std::sort(input.begin(), input.end());
     auto new_end = std::unique(input.begin(), input.end());
-    root = build_tree(input.begin(), new_end, true);
+    m_size = new_end - input.begin();
+    root = build_tree(input.begin(), new_end, true, m_leaf_size);
     update();
 }
 
-Point PointSet::update_top_right(const std::shared_ptr<Node> & left_son, const std::shared_ptr<Node> & right_son)
+template <typename Split>
+Point BasicPointSet<Split>::update_top_right(const std::shared_ptr<Node> & left_son, const std::shared_ptr<Node> & right_son)
 {
     return Point(
             std::max(left_son->region.get_top_right().x(), right_son->region.get_top_right().x()),
             std::max(left_son->region.get_top_right().y(), right_son->region.get_top_right().y()));
 }
 
-Point PointSet::update_bottom_left(const std::shared_ptr<Node> & left_son, const std::shared_ptr<Node> & right_son)
+template <typename Split>
+Point BasicPointSet<Split>::update_bottom_left(const std::shared_ptr<Node> & left_son, const std::shared_ptr<Node> & right_son)
 {
     return Point(
             std::min(left_son->region.get_bottom_left().x(), right_son->region.get_bottom_left().x()),
             std::min(left_son->region.get_bottom_left().y(), right_son->region.get_bottom_left().y()));
 }
 
-bool is_equal(double x, double y)
+//ties are broken by the other coordinate so that distinct points are never sent to the same side
+bool less(const Point & a, const Point & b, bool axis)
 {
-    return std::fabs(x - y) < std::numeric_limits<double>::epsilon();
+    if (axis) {
+        return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+    }
+    return a.y() < b.y() || (a.y() == b.y() && a.x() < b.x());
+}
+
+namespace {
+
+Rect bounding_box(std::vector<Point>::iterator first, std::vector<Point>::iterator last)
+{
+    auto [min_x, max_x] = std::minmax_element(first, last, [](const Point & a, const Point & b) { return a.x() < b.x(); });
+    auto [min_y, max_y] = std::minmax_element(first, last, [](const Point & a, const Point & b) { return a.y() < b.y(); });
+    return Rect(Point(min_x->x(), min_y->y()), Point(max_x->x(), max_y->y()));
+}
+
+//the axis on which the two points lie further apart
+bool wider(const Point & a, const Point & b)
+{
+    return std::abs(a.x() - b.x()) >= std::abs(a.y() - b.y());
+}
+
+std::size_t halve(std::vector<Point>::iterator first, std::vector<Point>::iterator last, bool axis)
+{
+    std::size_t half = (last - first) / 2;
+    std::nth_element(first, first + half, last, [axis](const Point & a, const Point & b) { return less(a, b, axis); });
+    return half;
+}
+
+} // namespace
+
+std::size_t MedianSplit::split(std::vector<Point>::iterator first, std::vector<Point>::iterator last, bool & axis)
+{
+    return halve(first, last, axis);
+}
+
+bool MedianSplit::axis(const Point &, const Point &, bool depth)
+{
+    return depth;
+}
+
+std::size_t SlidingMidpointSplit::split(std::vector<Point>::iterator first, std::vector<Point>::iterator last, bool & axis)
+{
+    Rect box = bounding_box(first, last);
+    axis = box.xmax() - box.xmin() >= box.ymax() - box.ymin();
+    double middle = (axis ? (box.xmin() + box.xmax()) / 2 : (box.ymin() + box.ymax()) / 2);
+    auto cut = std::partition(first, last, [axis, middle](const Point & p) { return (axis ? p.x() : p.y()) < middle; });
+    auto compare = [axis](const Point & a, const Point & b) { return less(a, b, axis); };
+    //rounding can leave a side empty, then the cut slides to the nearest point
+    if (cut == first) {
+        std::iter_swap(first, std::min_element(first, last, compare));
+        return 1;
+    }
+    if (cut == last) {
+        std::iter_swap(last - 1, std::max_element(first, last, compare));
+        return last - first - 1;
+    }
+    return cut - first;
+}
+
+bool SlidingMidpointSplit::axis(const Point & leaf, const Point & point, bool)
+{
+    return wider(leaf, point);
+}
+
+std::size_t WidestSpreadSplit::split(std::vector<Point>::iterator first, std::vector<Point>::iterator last, bool & axis)
+{
+    Rect box = bounding_box(first, last);
+    axis = box.xmax() - box.xmin() >= box.ymax() - box.ymin();
+    return halve(first, last, axis);
+}
+
+bool WidestSpreadSplit::axis(const Point & leaf, const Point & point, bool)
+{
+    return wider(leaf, point);
 }
 
-std::shared_ptr<PointSet::Node> PointSet::build_tree(std::vector<Point>::iterator start, std::vector<Point>::iterator finish, bool depth)
+std::size_t CostSplit::split(std::vector<Point>::iterator first, std::vector<Point>::iterator last, bool & axis)
 {
-    if (finish - start == 1) {
-        return std::make_shared<Node>(*start, Rect(*start, *start), nullptr, nullptr, nullptr);
+    std::size_t count = last - first;
+    std::size_t min_left = std::max<std::size_t>(1, count / 4);
+    std::size_t max_left = count - min_left;
+    auto half_perimeter = [](const Rect & r) { return (r.xmax() - r.xmin()) + (r.ymax() - r.ymin()); };
+    auto grow = [](const Rect & r, const Point & p) {
+        return Rect(Point(std::min(r.xmin(), p.x()), std::min(r.ymin(), p.y())), Point(std::max(r.xmax(), p.x()), std::max(r.ymax(), p.y())));
+    };
+
+    double best_cost = std::numeric_limits<double>::infinity();
+    std::size_t best_left = count / 2;
+    bool best_axis = axis;
+    std::vector<double> suffix(count);
+    for (bool candidate : {true, false}) {
+        std::sort(first, last, [candidate](const Point & a, const Point & b) { return less(a, b, candidate); });
+        //costs of the right parts are swept from the end, the left ones from the start
+        Rect box(*(last - 1), *(last - 1));
+        for (std::size_t i = count; i-- > min_left;) {
+            box = grow(box, *(first + i));
+            suffix[i] = half_perimeter(box) * (count - i);
+        }
+        box = Rect(*first, *first);
+        for (std::size_t left = 1; left <= max_left; ++left) {
+            box = grow(box, *(first + left - 1));
+            double cost = half_perimeter(box) * left + suffix[left];
+            if (left >= min_left && cost < best_cost) {
+                best_cost = cost;
+                best_left = left;
+                best_axis = candidate;
+            }
+        }
     }
-    auto lambda = (depth ? [](const Point & a, const Point & b) { return a.x() < b.x(); } : [](const Point & a, const Point & b) { return a.y() < b.y(); });
-    std::sort(start, finish, lambda);
+    if (best_axis) {
+        std::sort(first, last, [](const Point & a, const Point & b) { return less(a, b, true); });
+    }
+    axis = best_axis;
+    return best_left;
+}
+
+bool CostSplit::axis(const Point & leaf, const Point & point, bool)
+{
+    return wider(leaf, point);
+}
 
-    std::size_t median = std::upper_bound(start, finish, *(start + (finish - start) / 2), lambda) - start - 1;
+template <typename Split>
+std::shared_ptr<typename BasicPointSet<Split>::Node> BasicPointSet<Split>::build_tree(std::vector<Point>::iterator start, std::vector<Point>::iterator finish, bool depth, std::size_t leaf_size)
+{
+    if (static_cast<std::size_t>(finish - start) <= leaf_size) {
+        std::shared_ptr<Node> leaf = std::make_shared<Node>(*start, 1);
+        if (finish - start > 1) {
+            leaf->rest.reserve(finish - start - 1);
+            for (auto iter = start + 1; iter != finish; ++iter) {
+                leaf->rest.emplace_back(*iter, 1);
+            }
+            leaf->refresh();
+        }
+        return leaf;
+    }
+    //the node keeps the greatest point of its left subtree, so that find() goes left for everything up to it
+    std::size_t median = Split::split(start, finish, depth);
+    Point split = *std::max_element(start, start + median, [depth](const Point & a, const Point & b) { return less(a, b, depth); });
 
-    std::shared_ptr<Node> left_son(build_tree(start, start + median, !depth));
-    std::shared_ptr<Node> right_son(build_tree(start + median, finish, !depth));
+    std::shared_ptr<Node> left_son(build_tree(start, start + median, !depth, leaf_size));
+    std::shared_ptr<Node> right_son(build_tree(start + median, finish, !depth, leaf_size));
     Point bottom_left = update_bottom_left(left_son, right_son);
     Point top_right = update_top_right(left_son, right_son);
-    std::shared_ptr<Node> cur = std::make_shared<Node>(*(start + median), Rect(bottom_left, top_right), left_son, right_son, nullptr);
+    std::shared_ptr<Node> cur = std::make_shared<Node>(split, Rect(bottom_left, top_right), left_son, right_son, nullptr);
+    cur->depth = depth;
     left_son->parent = cur;
     right_son->parent = cur;
 
     return cur;
 }
 
-void PointSet::update()
+template <typename Split>
+void BasicPointSet<Split>::update()
 {
     if (empty()) {
         return;
@@ -70,7 +204,8 @@ void PointSet::update()
     }
 }
 
-std::shared_ptr<PointSet::Node> PointSet::next(std::shared_ptr<Node> cur) const
+template <typename Split>
+std::shared_ptr<typename BasicPointSet<Split>::Node> BasicPointSet<Split>::next(std::shared_ptr<Node> cur) const
 {
     if (cur == end_pointer) {
         return nullptr;
@@ -91,69 +226,395 @@ std::shared_ptr<PointSet::Node> PointSet::next(std::shared_ptr<Node> cur) const
     return cur;
 }
 
-bool PointSet::contains(const Point & point) const
+template <typename Split>
+bool BasicPointSet<Split>::contains(const Point & point) const
 {
-    std::shared_ptr<Node> result(find(root, point, true).first);
-    return result != nullptr && point == result->data;
+    if (root == nullptr) {
+        return false;
+    }
+    std::shared_ptr<Node> leaf(find(root, point, true).first);
+    return leaf->index_of(point) != leaf->count();
 }
 
-std::pair<std::shared_ptr<PointSet::Node>, bool> PointSet::find(std::shared_ptr<Node> cur, const Point & to_find, bool depth) const
+template <typename Split>
+std::pair<std::shared_ptr<typename BasicPointSet<Split>::Node>, bool> BasicPointSet<Split>::find(std::shared_ptr<Node> cur, const Point & to_find, bool depth) const
 {
     while (cur->left != nullptr) {
-        if (depth) {
-            cur = (cur->data.x() < to_find.x() ? cur->right : cur->left);
-        }
-        else {
-            cur = (cur->data.y() < to_find.y() ? cur->right : cur->left);
-        }
-        depth = !depth;
+        depth = !cur->depth;
+        cur = (less(cur->data, to_find, cur->depth) ? cur->right : cur->left);
     }
     return std::make_pair(cur, depth);
 }
 
-void PointSet::restore(const std::shared_ptr<Node> & cur)
+template <typename Split>
+void BasicPointSet<Split>::restore(const std::shared_ptr<Node> & cur)
 {
     Point bottom_left = update_bottom_left(cur->left, cur->right);
     Point top_right = update_top_right(cur->left, cur->right);
     cur->region = Rect(bottom_left, top_right);
+    cur->summary = cur->left->summary + cur->right->summary;
     if (cur->parent.lock() != nullptr) {
         restore(cur->parent.lock());
     }
 }
 
-void PointSet::put(const Point & point)
+template <typename Split>
+void BasicPointSet<Split>::put(const Point & point, double weight)
 {
     if (root == nullptr) {
-        root = std::make_shared<Node>(point, Rect(point, point), nullptr, nullptr, nullptr);
+        root = std::make_shared<Node>(point, weight);
         ++m_size;
     }
     else {
         std::pair<std::shared_ptr<Node>, bool> result = find(root, point, true);
         std::shared_ptr<Node> cur = result.first;
-        if (cur->data == point) {
+        if (cur->index_of(point) != cur->count()) {
             return;
         }
-        bool depth = result.second;
         ++m_size;
-        std::shared_ptr<Node> left = std::make_shared<Node>(cur->data, cur->region, nullptr, nullptr, cur);
-        std::shared_ptr<Node> right = std::make_shared<Node>(point, Rect(point, point), nullptr, nullptr, cur);
-        if ((depth && cur->data.x() > point.x()) || (!depth && cur->data.y() > point.y())) {
-            std::swap(left, right);
-            cur->data = point;
+        cur->rest.emplace_back(point, weight);
+        if (cur->count() <= m_leaf_size) {
+            cur->refresh();
+            if (cur->parent.lock() != nullptr) {
+                restore(cur->parent.lock());
+            }
+        }
+        else {
+            //a full leaf is rebuilt into a subtree of its own, which the node takes over so that its parent keeps it
+            std::vector<Point> points;
+            std::unordered_map<Point, double, point_hash> weights;
+            for (std::size_t i = 0; i < cur->count(); ++i) {
+                points.push_back(cur->point(i));
+                if (cur->weight_of(i) != 1) {
+                    weights.emplace(cur->point(i), cur->weight_of(i));
+                }
+            }
+            std::shared_ptr<Node> subtree = build_tree(points.begin(), points.end(), Split::axis(cur->data, point, result.second), m_leaf_size);
+            if (!weights.empty()) {
+                assign_weights(subtree, weights);
+            }
+            cur->rest.clear();
+            cur->rest.shrink_to_fit();
+            cur->data = subtree->data;
+            cur->depth = subtree->depth;
+            cur->left = subtree->left;
+            cur->right = subtree->right;
+            cur->left->parent = cur;
+            cur->right->parent = cur;
+            restore(cur);
         }
-        cur->data = left->data;
-        cur->left = left;
-        cur->right = right;
-        restore(cur);
     }
     update();
 }
 
+template <typename Split>
+bool BasicPointSet<Split>::erase(const Point & point)
+{
+    if (root == nullptr) {
+        return false;
+    }
+    std::shared_ptr<Node> leaf = find(root, point, true).first;
+    std::size_t index = leaf->index_of(point);
+    if (index == leaf->count()) {
+        return false;
+    }
+    --m_size;
+    std::shared_ptr<Node> parent = leaf->parent.lock();
+    //a leaf keeping other points only shrinks its box
+    if (leaf->count() > 1) {
+        leaf->remove(index);
+        leaf->refresh();
+        if (parent != nullptr) {
+            restore(parent);
+        }
+        return true;
+    }
+    begin_pointer = nullptr;
+    end_pointer = nullptr;
+    if (parent == nullptr) {
+        root = nullptr;
+        return true;
+    }
+    //the sibling takes the place of the parent, together with its split axis
+    std::shared_ptr<Node> sibling = (parent->left == leaf ? parent->right : parent->left);
+    parent->data = sibling->data;
+    parent->depth = sibling->depth;
+    parent->region = sibling->region;
+    parent->summary = sibling->summary;
+    parent->weight = sibling->weight;
+    parent->rest = std::move(sibling->rest);
+    parent->left = sibling->left;
+    parent->right = sibling->right;
+    if (parent->left != nullptr) {
+        parent->left->parent = parent;
+        parent->right->parent = parent;
+    }
+    //the boxes above lose the erased point as well, so they are rebuilt like after a put
+    if (parent->parent.lock() != nullptr) {
+        restore(parent->parent.lock());
+    }
+    update();
+    return true;
+}
+
+template <typename Split>
+bool BasicPointSet<Split>::move(const Point & from, const Point & to)
+{
+    if (root == nullptr) {
+        return false;
+    }
+    //both points are routed at once; where they part, the split key can still be shifted past `to` as long as
+    //the box of the other child stays on its side. raw pointers spare the reference counting
+    std::vector<Node *> path;
+    std::vector<std::pair<Node *, Point>> shifted;
+    Node * cur = root.get();
+    bool same_leaf = true;
+    while (cur->left != nullptr) {
+        path.push_back(cur);
+        bool right = less(cur->data, from, cur->depth);
+        if (same_leaf && right != less(cur->data, to, cur->depth)) {
+            const Rect & other = (right ? cur->left : cur->right)->region;
+            Point key = (right ? Point(other.xmax(), other.ymax()) : to);
+            same_leaf = (right ? less(key, to, cur->depth) : less(to, Point(other.xmin(), other.ymin()), cur->depth));
+            shifted.emplace_back(cur, key);
+        }
+        cur = (right ? cur->right : cur->left).get();
+    }
+    std::size_t index = cur->index_of(from);
+    if (index == cur->count()) {
+        return false;
+    }
+    //landing on another point of the same leaf is a merge like any other
+    bool taken = from != to && cur->index_of(to) != cur->count();
+    if (same_leaf && !taken) {
+        for (auto & [node, key] : shifted) {
+            node->data = key;
+        }
+        cur->point(index) = to;
+        cur->refresh();
+        //every box on the path is rebuilt from its children, up to the first one that comes out unchanged;
+        //above it only the sums change
+        bool resized = true;
+        for (auto iter = path.rbegin(); iter != path.rend(); ++iter) {
+            Node & node = **iter;
+            if (resized) {
+                Point bottom_left = update_bottom_left(node.left, node.right);
+                Point top_right = update_top_right(node.left, node.right);
+                resized = !(bottom_left == node.region.get_bottom_left() && top_right == node.region.get_top_right());
+                node.region = Rect(bottom_left, top_right);
+            }
+            node.summary = node.left->summary + node.right->summary;
+        }
+        return true;
+    }
+    double weight = cur->weight_of(index);
+    bool merged = contains(to);
+    erase(from);
+    if (!merged) {
+        put(to, weight);
+    }
+    return true;
+}
+
+template <typename Split>
+std::size_t BasicPointSet<Split>::move(std::vector<std::pair<Point, Point>> moves) //NOLINT "moves can be a const reference" -- we reorder them
+{
+    if (root == nullptr) {
+        return 0;
+    }
+    //the bits of the cell coordinates are interleaved, 16 of them per axis
+    auto spread = [](std::uint64_t v) {
+        v = (v | (v << 8)) & 0x00FF00FFULL;
+        v = (v | (v << 4)) & 0x0F0F0F0FULL;
+        v = (v | (v << 2)) & 0x33333333ULL;
+        return (v | (v << 1)) & 0x55555555ULL;
+    };
+    const Rect & box = root->region;
+    auto cell = [](double value, double min, double max) {
+        return static_cast<std::uint64_t>(max > min ? std::clamp((value - min) / (max - min), 0.0, 1.0) * 0xFFFF : 0);
+    };
+    std::vector<std::pair<std::uint64_t, std::size_t>> order(moves.size());
+    for (std::size_t i = 0; i < moves.size(); ++i) {
+        const Point & from = moves[i].first;
+        order[i] = {spread(cell(from.x(), box.xmin(), box.xmax())) | (spread(cell(from.y(), box.ymin(), box.ymax())) << 1), i};
+    }
+    std::sort(order.begin(), order.end());
+    std::size_t moved = 0;
+    for (const auto & [code, i] : order) {
+        moved += move(moves[i].first, moves[i].second);
+    }
+    return moved;
+}
+
+//appends the points of the leaves in order, skipping those already in `skip`; a weight other than 1 is noted in the table
+template <typename Split>
+void BasicPointSet<Split>::collect(const std::shared_ptr<Node> & cur, const BasicPointSet * skip, std::vector<Point> & points, std::unordered_map<Point, double, point_hash> & weights)
+{
+    if (cur->left == nullptr) {
+        for (std::size_t i = 0; i < cur->count(); ++i) {
+            if (skip == nullptr || !skip->contains(cur->point(i))) {
+                points.push_back(cur->point(i));
+                if (cur->weight_of(i) != 1) {
+                    weights.emplace(cur->point(i), cur->weight_of(i));
+                }
+            }
+        }
+    }
+    else {
+        collect(cur->left, skip, points, weights);
+        collect(cur->right, skip, points, weights);
+    }
+}
+
+//points take their weights from the table, 1 when they are not in it; nodes sum them up again
+template <typename Split>
+typename BasicPointSet<Split>::Summary BasicPointSet<Split>::assign_weights(const std::shared_ptr<Node> & cur, const std::unordered_map<Point, double, point_hash> & weights)
+{
+    if (cur->left == nullptr) {
+        for (std::size_t i = 0; i < cur->count(); ++i) {
+            auto found = weights.find(cur->point(i));
+            cur->weight_of(i) = (found == weights.end() ? 1 : found->second);
+        }
+        cur->refresh();
+    }
+    else {
+        cur->summary = assign_weights(cur->left, weights) + assign_weights(cur->right, weights);
+    }
+    return cur->summary;
+}
+
+template <typename Split>
+BasicPointSet<Split> BasicPointSet<Split>::merge(BasicPointSet && a, BasicPointSet && b)
+{
+    BasicPointSet first = std::exchange(a, BasicPointSet());
+    BasicPointSet second = std::exchange(b, BasicPointSet());
+    std::vector<Point> points;
+    std::unordered_map<Point, double, point_hash> weights;
+    points.reserve(first.size() + second.size());
+    //a point of b that a already holds is dropped, so the one from a keeps its weight
+    if (first.root != nullptr) {
+        collect(first.root, nullptr, points, weights);
+    }
+    if (second.root != nullptr) {
+        collect(second.root, first.root == nullptr ? nullptr : &first, points, weights);
+    }
+
+    BasicPointSet result;
+    result.m_leaf_size = first.m_leaf_size;
+    if (!points.empty()) {
+        result.m_size = points.size();
+        result.root = build_tree(points.begin(), points.end(), true, result.m_leaf_size);
+        if (!weights.empty()) {
+            assign_weights(result.root, weights);
+        }
+        result.update();
+    }
+    return result;
+}
+
+template <typename Split>
+std::shared_ptr<typename BasicPointSet<Split>::Node> BasicPointSet<Split>::join(std::shared_ptr<Node> a, std::shared_ptr<Node> b, const Point & key, bool axis)
+{
+    if (a == nullptr || b == nullptr) {
+        return (a == nullptr ? b : a);
+    }
+    std::shared_ptr<Node> cur = std::make_shared<Node>(key, Rect(update_bottom_left(a, b), update_top_right(a, b)), a, b, nullptr);
+    cur->depth = axis;
+    a->parent = cur;
+    b->parent = cur;
+    return cur;
+}
+
+//both parts of a node straddling the value are joined under a new node with the same key, which still separates them
+template <typename Split>
+std::pair<std::shared_ptr<typename BasicPointSet<Split>::Node>, std::shared_ptr<typename BasicPointSet<Split>::Node>> BasicPointSet<Split>::split_impl(const std::shared_ptr<Node> & cur, bool axis, double value, bool inclusive)
+{
+    if (cur == nullptr) {
+        return {};
+    }
+    auto below = [value, inclusive](double coord) { return coord < value || (inclusive && coord == value); };
+    if (below(axis ? cur->region.xmax() : cur->region.ymax())) {
+        return {cur, nullptr};
+    }
+    if (!below(axis ? cur->region.xmin() : cur->region.ymin())) {
+        return {nullptr, cur};
+    }
+    if (cur->left == nullptr) {
+        //a leaf holding points on both sides is cut in two
+        std::shared_ptr<Node> parts[2];
+        for (std::size_t i = 0; i < cur->count(); ++i) {
+            const Point & point = cur->point(i);
+            std::shared_ptr<Node> & part = parts[below(axis ? point.x() : point.y()) ? 0 : 1];
+            if (part == nullptr) {
+                part = std::make_shared<Node>(point, cur->weight_of(i));
+            }
+            else {
+                part->rest.emplace_back(point, cur->weight_of(i));
+            }
+        }
+        parts[0]->refresh();
+        parts[1]->refresh();
+        return {parts[0], parts[1]};
+    }
+    auto [left_below, left_above] = split_impl(cur->left, axis, value, inclusive);
+    auto [right_below, right_above] = split_impl(cur->right, axis, value, inclusive);
+    return {join(left_below, right_below, cur->data, cur->depth), join(left_above, right_above, cur->data, cur->depth)};
+}
+
+template <typename Split>
+BasicPointSet<Split> BasicPointSet<Split>::adopt(std::shared_ptr<Node> root, std::size_t leaf_size)
+{
+    BasicPointSet result;
+    result.m_leaf_size = leaf_size;
+    if (root != nullptr) {
+        root->parent.reset();
+        result.m_size = root->summary.count;
+        result.root = std::move(root);
+        result.update();
+    }
+    return result;
+}
+
+template <typename Split>
+std::pair<BasicPointSet<Split>, BasicPointSet<Split>> BasicPointSet<Split>::split_at(BasicPointSet && set, bool axis, double value)
+{
+    BasicPointSet source = std::exchange(set, BasicPointSet());
+    if (source.root == nullptr) {
+        return {};
+    }
+    auto [below, above] = split_impl(source.root, axis, value, false);
+    return {adopt(below, source.m_leaf_size), adopt(above, source.m_leaf_size)};
+}
+
+//the four parts cut off around the rectangle are separated along x (left, middle, right) and the middle one along y,
+//so they are joined with the corner of the lower part as the key
+template <typename Split>
+std::pair<BasicPointSet<Split>, BasicPointSet<Split>> BasicPointSet<Split>::split(BasicPointSet && set, const Rect & rect)
+{
+    BasicPointSet source = std::exchange(set, BasicPointSet());
+    if (source.root == nullptr) {
+        return {};
+    }
+    auto [left, rest] = split_impl(source.root, true, rect.xmin(), false);
+    auto [column, right] = split_impl(rest, true, rect.xmax(), true);
+    auto [bottom, upper] = split_impl(column, false, rect.ymin(), false);
+    auto [inside, top] = split_impl(upper, false, rect.ymax(), true);
+
+    auto corner = [](const std::shared_ptr<Node> & cur) { return (cur != nullptr ? cur->region.get_top_right() : Point(0, 0)); };
+    std::shared_ptr<Node> outside = join(left, join(bottom, top, corner(bottom), false), corner(left), true);
+    outside = join(outside, right, corner(outside), true);
+    return {adopt(inside, source.m_leaf_size), adopt(outside, source.m_leaf_size)};
+}
+
 //marks all the points in a subtree as a result
-void PointSet::report_subtree(const std::shared_ptr<Node> & cur, const std::shared_ptr<std::vector<Point>> & result)
+template <typename Split>
+void BasicPointSet<Split>::report_subtree(const std::shared_ptr<Node> & cur, const std::shared_ptr<std::vector<Point>> & result)
 {
     if (cur->left == nullptr) {
         result->push_back(cur->data);
+        for (const auto & [point, weight] : cur->rest) {
+            result->push_back(point);
+        }
     }
     else {
         report_subtree(cur->left, result);
@@ -162,7 +623,8 @@ void PointSet::report_subtree(const std::shared_ptr<Node> & cur, const std::shar
 }
 
 //prevents copy-paste
-void PointSet::search_range_child(const std::shared_ptr<Node> & child, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result)
+template <typename Split>
+void BasicPointSet<Split>::search_range_child(const std::shared_ptr<Node> & child, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result)
 {
     if (rect.contains(child->region)) {
         report_subtree(child, result);
@@ -172,11 +634,14 @@ void PointSet::search_range_child(const std::shared_ptr<Node> & child, const Rec
     }
 }
 
-void PointSet::search_range(const std::shared_ptr<Node> & cur, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result)
+template <typename Split>
+void BasicPointSet<Split>::search_range(const std::shared_ptr<Node> & cur, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result)
 {
     if (cur->left == nullptr) {
-        if (rect.contains(cur->data)) {
-            result->push_back(cur->data);
+        for (std::size_t i = 0; i < cur->count(); ++i) {
+            if (rect.contains(cur->point(i))) {
+                result->push_back(cur->point(i));
+            }
         }
     }
     else {
@@ -185,89 +650,320 @@ void PointSet::search_range(const std::shared_ptr<Node> & cur, const Rect & rect
     }
 }
 
-bool PointSet::empty() const
+//the rectangles that still need the child are split into those covering it entirely and those that go further down
+template <typename Split>
+void BasicPointSet<Split>::search_range_multi_child(const std::shared_ptr<Node> & child, const std::vector<std::array<double, 4>> & rects, std::vector<std::size_t>::iterator first, std::vector<std::size_t>::iterator last, const std::vector<std::shared_ptr<std::vector<Point>>> & results)
+{
+    //the box of the child is read once for all the rectangles, which are reordered in place: the ones crossing
+    //the child go first, then the covering ones; the sibling partitions the same range again, so nothing is allocated
+    double xmin = child->region.xmin();
+    double ymin = child->region.ymin();
+    double xmax = child->region.xmax();
+    double ymax = child->region.ymax();
+    auto crossing_end = first;
+    auto covering_end = first;
+    for (auto iter = first; iter != last; ++iter) {
+        const std::array<double, 4> & rect = rects[*iter];
+        if (rect[0] <= xmin && rect[1] <= ymin && xmax <= rect[2] && ymax <= rect[3]) {
+            std::iter_swap(iter, covering_end++);
+        }
+        else if (rect[0] <= xmax && xmin <= rect[2] && rect[1] <= ymax && ymin <= rect[3]) {
+            std::iter_swap(iter, covering_end);
+            std::iter_swap(covering_end++, crossing_end++);
+        }
+    }
+    if (crossing_end != covering_end) {
+        //the subtree is walked once and then copied to the other rectangles covering it
+        const std::vector<Point> & source = *results[*crossing_end];
+        std::size_t before = source.size();
+        report_subtree(child, results[*crossing_end]);
+        for (auto iter = crossing_end + 1; iter != covering_end; ++iter) {
+            results[*iter]->insert(results[*iter]->end(), source.begin() + before, source.end());
+        }
+    }
+    if (first != crossing_end) {
+        search_range_multi(child, rects, first, crossing_end, results);
+    }
+}
+
+template <typename Split>
+void BasicPointSet<Split>::search_range_multi(const std::shared_ptr<Node> & cur, const std::vector<std::array<double, 4>> & rects, std::vector<std::size_t>::iterator first, std::vector<std::size_t>::iterator last, const std::vector<std::shared_ptr<std::vector<Point>>> & results)
+{
+    if (cur->left == nullptr) {
+        //the rectangles that got here only cross the box of the leaf, so its points are checked one by one
+        for (; first != last; ++first) {
+            const std::array<double, 4> & rect = rects[*first];
+            for (std::size_t i = 0; i < cur->count(); ++i) {
+                const Point & point = cur->point(i);
+                if (rect[0] <= point.x() && rect[1] <= point.y() && point.x() <= rect[2] && point.y() <= rect[3]) {
+                    results[*first]->push_back(point);
+                }
+            }
+        }
+    }
+    else {
+        search_range_multi_child(cur->left, rects, first, last, results);
+        search_range_multi_child(cur->right, rects, first, last, results);
+    }
+}
+
+template <typename Split>
+typename BasicPointSet<Split>::Summary BasicPointSet<Split>::summarize(const std::shared_ptr<Node> & cur, const Rect & rect)
+{
+    if (rect.contains(cur->region)) {
+        return cur->summary;
+    }
+    if (!rect.intersects(cur->region)) {
+        return {};
+    }
+    if (cur->left == nullptr) {
+        Summary result;
+        for (std::size_t i = 0; i < cur->count(); ++i) {
+            const Point & point = cur->point(i);
+            if (rect.contains(point)) {
+                result = result + Summary{1, point.x(), point.y(), cur->weight_of(i)};
+            }
+        }
+        return result;
+    }
+    return summarize(cur->left, rect) + summarize(cur->right, rect);
+}
+
+template <typename Split>
+typename BasicPointSet<Split>::Summary BasicPointSet<Split>::summarize(const Rect & rect) const
+{
+    if (root == nullptr) {
+        return {};
+    }
+    return summarize(root, rect);
+}
+
+template <typename Split>
+std::size_t BasicPointSet<Split>::count(const Rect & rect) const
+{
+    return summarize(rect).count;
+}
+
+template <typename Split>
+double BasicPointSet<Split>::sum_weights(const Rect & rect) const
+{
+    return summarize(rect).weight;
+}
+
+template <typename Split>
+std::optional<Point> BasicPointSet<Split>::centroid(const Rect & rect) const
+{
+    Summary summary = summarize(rect);
+    if (summary.count == 0) {
+        return {};
+    }
+    return Point(summary.sum_x / summary.count, summary.sum_y / summary.count);
+}
+
+template <typename Split>
+double BasicPointSet<Split>::box_cost(const std::shared_ptr<Node> & cur, double width, double height)
+{
+    double cost = (cur->region.xmax() - cur->region.xmin() + width) * (cur->region.ymax() - cur->region.ymin() + height);
+    if (cur->left != nullptr) {
+        cost += box_cost(cur->left, width, height) + box_cost(cur->right, width, height);
+    }
+    return cost;
+}
+
+//a query with its corner placed uniformly where it still touches the bounds meets a box with the probability
+//of the box grown by the query size against the bounds grown by it
+template <typename Split>
+double BasicPointSet<Split>::expected_cost(double width, double height) const
+{
+    if (root == nullptr) {
+        return 0;
+    }
+    const Rect & bounds = root->region;
+    return box_cost(root, width, height) / ((bounds.xmax() - bounds.xmin() + width) * (bounds.ymax() - bounds.ymin() + height));
+}
+
+template <typename Split>
+bool BasicPointSet<Split>::empty() const
 {
     return m_size == 0;
 }
 
-std::size_t PointSet::size() const
+template <typename Split>
+std::size_t BasicPointSet<Split>::size() const
 {
     return m_size;
 }
 
-std::pair<PointSet::iterator, PointSet::iterator> PointSet::range(const Rect & rect) const
+template <typename Split>
+std::size_t BasicPointSet<Split>::leaf_size() const
+{
+    return m_leaf_size;
+}
+
+template <typename Split>
+std::optional<Rect> BasicPointSet<Split>::bounds() const
+{
+    if (root == nullptr) {
+        return {};
+    }
+    return root->region;
+}
+
+template <typename Split>
+std::pair<typename BasicPointSet<Split>::iterator, typename BasicPointSet<Split>::iterator> BasicPointSet<Split>::range(const Rect & rect) const
 {
     std::shared_ptr<std::vector<Point>> result = std::make_shared<std::vector<Point>>();
-    search_range(root, rect, result);
+    if (root != nullptr) {
+        search_range(root, rect, result);
+    }
     return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
 }
 
-PointSet::iterator PointSet::begin() const
+template <typename Split>
+std::vector<std::pair<typename BasicPointSet<Split>::iterator, typename BasicPointSet<Split>::iterator>> BasicPointSet<Split>::range_multi(const std::vector<Rect> & rects) const
+{
+    std::vector<std::shared_ptr<std::vector<Point>>> results(rects.size());
+    std::vector<std::size_t> active(rects.size());
+    //the corners are unpacked once, the walk compares plain numbers
+    std::vector<std::array<double, 4>> corners(rects.size());
+    for (std::size_t i = 0; i < rects.size(); ++i) {
+        results[i] = std::make_shared<std::vector<Point>>();
+        active[i] = i;
+        corners[i] = {rects[i].xmin(), rects[i].ymin(), rects[i].xmax(), rects[i].ymax()};
+    }
+    if (root != nullptr && !rects.empty()) {
+        search_range_multi_child(root, corners, active.begin(), active.end(), results);
+    }
+    std::vector<std::pair<iterator, iterator>> ranges;
+    ranges.reserve(rects.size());
+    for (const std::shared_ptr<std::vector<Point>> & result : results) {
+        ranges.emplace_back(iterator(result, result->begin()), iterator(result, result->end()));
+    }
+    return ranges;
+}
+
+template <typename Split>
+typename BasicPointSet<Split>::iterator BasicPointSet<Split>::begin() const
 {
     return iterator(this, begin_pointer);
 }
 
-PointSet::iterator PointSet::end() const
+template <typename Split>
+typename BasicPointSet<Split>::iterator BasicPointSet<Split>::end() const
 {
     return iterator(this, nullptr);
 }
 
-//with a one-point result
-Point PointSet::nearest_impl(const std::shared_ptr<Node> & cur, const Point & point, double min)
+//with a one-point result; inner nodes only hold split keys, so candidates come from the leaves
+template <typename Split>
+void BasicPointSet<Split>::nearest_impl(const std::shared_ptr<Node> & cur, const Point & point, Point & best, double & min)
 {
-    min = std::min(min, cur->data.distance(point));
     if (cur->left == nullptr) {
-        return cur->data;
-    }
-    else {
-        Point left = cur->data;
-        Point right = cur->data;
-        if (cur->left->region.distance(point) <= min) {
-            left = nearest_impl(cur->left, point, min);
-        }
-        if (cur->right->region.distance(point) <= min) {
-            right = nearest_impl(cur->right, point, min);
+        for (std::size_t i = 0; i < cur->count(); ++i) {
+            const Point & candidate = cur->point(i);
+            if (point.distance(candidate) < min) {
+                min = point.distance(candidate);
+                best = candidate;
+            }
         }
-        double left_dist = point.distance(left);
-        double right_dist = point.distance(right);
-
-        return (left_dist < right_dist ? left : right);
+        return;
+    }
+    bool left_first = cur->left->region.distance(point) <= cur->right->region.distance(point);
+    const std::shared_ptr<Node> & first = (left_first ? cur->left : cur->right);
+    const std::shared_ptr<Node> & second = (left_first ? cur->right : cur->left);
+    if (first->region.distance(point) < min) {
+        nearest_impl(first, point, best, min);
+    }
+    if (second->region.distance(point) < min) {
+        nearest_impl(second, point, best, min);
     }
 }
 
-std::optional<Point> PointSet::nearest(const Point & point) const
+template <typename Split>
+std::optional<Point> BasicPointSet<Split>::nearest(const Point & point) const
 {
     if (root == nullptr) {
         return {};
     }
-    return nearest_impl(root, point, point.distance(root->data));
+    Point best = root->data;
+    double min = std::numeric_limits<double>::infinity();
+    nearest_impl(root, point, best, min);
+    return best;
 }
 
-//with multiple-points result
-void PointSet::nearest_impl(const std::shared_ptr<Node> & cur, const Point & point, std::size_t k, std::shared_ptr<std::vector<std::pair<double, Point>>> & heap)
+//with multiple-points result; the heap keeps the k best candidates, so a box that can't beat the worst of them is skipped
+template <typename Split>
+void BasicPointSet<Split>::nearest_impl(const std::shared_ptr<Node> & cur, const Point & point, std::size_t k, const Rect * clip, const std::function<bool(const Point &)> & filter, std::vector<std::pair<double, Point>> & heap)
 {
     if (cur->left == nullptr) {
-        heap->push_back({point.distance(cur->data), cur->data});
-        std::push_heap(heap->begin(), heap->end());
-        if (heap->size() > k) {
-            std::pop_heap(heap->begin(), heap->end());
-            heap->pop_back();
+        for (std::size_t i = 0; i < cur->count(); ++i) {
+            const Point & candidate = cur->point(i);
+            if ((clip != nullptr && !clip->contains(candidate)) || (filter && !filter(candidate))) {
+                continue;
+            }
+            heap.push_back({point.distance(candidate), candidate});
+            std::push_heap(heap.begin(), heap.end());
+            if (heap.size() > k) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.pop_back();
+            }
         }
+        return;
     }
-    else {
-        nearest_impl(cur->left, point, k, heap);
-        nearest_impl(cur->right, point, k, heap);
+    bool left_first = cur->left->region.distance(point) <= cur->right->region.distance(point);
+    auto visit = [&](const std::shared_ptr<Node> & child) {
+        bool clipped = clip != nullptr && !clip->intersects(child->region);
+        if (!clipped && (heap.size() < k || child->region.distance(point) < heap.front().first)) {
+            nearest_impl(child, point, k, clip, filter, heap);
+        }
+    };
+    visit(left_first ? cur->left : cur->right);
+    visit(left_first ? cur->right : cur->left);
+}
+
+template <typename Split>
+std::pair<typename BasicPointSet<Split>::iterator, typename BasicPointSet<Split>::iterator> BasicPointSet<Split>::nearest(const Point & p, std::size_t k) const
+{
+    return nearest(p, k, std::function<bool(const Point &)>());
+}
+
+template <typename Split>
+std::pair<typename BasicPointSet<Split>::iterator, typename BasicPointSet<Split>::iterator> BasicPointSet<Split>::nearest(const Point & p, std::size_t k, const std::function<bool(const Point &)> & filter) const
+{
+    std::shared_ptr<std::vector<std::pair<double, Point>>> result = std::make_shared<std::vector<std::pair<double, Point>>>();
+    if (root != nullptr && k != 0) {
+        nearest_impl(root, p, k, nullptr, filter, *result);
     }
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
 }
 
-std::pair<PointSet::iterator, PointSet::iterator> PointSet::nearest(const Point & p, std::size_t k) const
+template <typename Split>
+std::pair<typename BasicPointSet<Split>::iterator, typename BasicPointSet<Split>::iterator> BasicPointSet<Split>::nearest(const Point & p, std::size_t k, const Rect & clip, const std::function<bool(const Point &)> & filter) const
 {
     std::shared_ptr<std::vector<std::pair<double, Point>>> result = std::make_shared<std::vector<std::pair<double, Point>>>();
-    nearest_impl(root, p, k, result);
+    if (root != nullptr && k != 0 && clip.intersects(root->region)) {
+        nearest_impl(root, p, k, &clip, filter, *result);
+    }
     return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
 }
 
-PointSet::PointSet(const std::string & filename)
+template <typename Split>
+std::optional<Point> BasicPointSet<Split>::nearest(const Point & point, const Rect & clip, const std::function<bool(const Point &)> & filter) const
+{
+    auto [first, last] = nearest(point, 1, clip, filter);
+    return (first != last ? std::optional<Point>(*first) : std::nullopt);
+}
+
+template <typename Split>
+std::optional<Point> BasicPointSet<Split>::nearest(const Point & point, const std::function<bool(const Point &)> & filter) const
+{
+    auto [first, last] = nearest(point, 1, filter);
+    return (first != last ? std::optional<Point>(*first) : std::nullopt);
+}
+
+template <typename Split>
+BasicPointSet<Split>::BasicPointSet(const std::string & filename, std::size_t leaf_size)
+    : m_leaf_size(std::max<std::size_t>(1, leaf_size))
 {
     if (!filename.empty()) {
         std::ifstream file(filename);
@@ -283,4 +979,62 @@ PointSet::PointSet(const std::string & filename)
     }
 }
 
+template <typename Split>
+BasicPointSet<Split>::BasicPointSet(std::vector<Point> points, std::size_t leaf_size)
+    : m_leaf_size(std::max<std::size_t>(1, leaf_size))
+{
+    constructor_impl(std::move(points));
+}
+
+std::pair<PointSet::iterator, PointSet::iterator> nearest_of_parts(
+        const Point & p,
+        std::size_t k,
+        std::size_t parts,
+        bool shared,
+        const std::function<std::optional<Rect>(std::size_t)> & bounds,
+        const std::function<std::pair<PointSet::iterator, PointSet::iterator>(std::size_t, std::size_t)> & nearest)
+{
+    std::shared_ptr<std::vector<std::pair<double, Point>>> result = std::make_shared<std::vector<std::pair<double, Point>>>();
+    if (k == 0) {
+        return std::make_pair(PointSet::iterator(result, result->begin()), PointSet::iterator(result, result->end()));
+    }
+    std::vector<std::pair<double, std::size_t>> order;
+    for (std::size_t i = 0; i < parts; ++i) {
+        std::optional<Rect> box = bounds(i);
+        if (box) {
+            order.emplace_back(box->distance(p), i);
+        }
+    }
+    std::sort(order.begin(), order.end());
+
+    //the heap keeps the k best candidates, so its top is the distance a farther part has to beat
+    for (const auto & [distance, index] : order) {
+        if (result->size() == k && distance >= result->front().first) {
+            break;
+        }
+        auto [first, last] = nearest(index, k);
+        for (auto iter = first; iter != last; ++iter) {
+            double candidate = p.distance(*iter);
+            if (result->size() == k && candidate >= result->front().first) {
+                continue;
+            }
+            if (shared && std::any_of(result->begin(), result->end(), [&](const std::pair<double, Point> & entry) { return entry.second == *iter; })) {
+                continue;
+            }
+            result->push_back({candidate, *iter});
+            std::push_heap(result->begin(), result->end());
+            if (result->size() > k) {
+                std::pop_heap(result->begin(), result->end());
+                result->pop_back();
+            }
+        }
+    }
+    return std::make_pair(PointSet::iterator(result, result->begin()), PointSet::iterator(result, result->end()));
+}
+
+template class BasicPointSet<MedianSplit>;
+template class BasicPointSet<SlidingMidpointSplit>;
+template class BasicPointSet<WidestSpreadSplit>;
+template class BasicPointSet<CostSplit>;
+
 } // namespace kdtree
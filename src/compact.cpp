@@ -0,0 +1,327 @@
+#include "primitives.h"
+
+namespace compact {
+
+template <typename Offset>
+double PointSet<Offset>::decode(double min, double max, Offset code)
+{
+    return (code == max_offset ? max : min + (max - min) / max_offset * code);
+}
+
+//the greatest code that does not decode above the value
+template <typename Offset>
+Offset PointSet<Offset>::encode_down(double min, double max, double value)
+{
+    if (!(max > min)) {
+        return 0;
+    }
+    double estimate = std::floor((value - min) / (max - min) * max_offset);
+    Offset code = static_cast<Offset>(std::clamp(estimate, 0.0, static_cast<double>(max_offset)));
+    while (code > 0 && decode(min, max, code) > value) {
+        --code;
+    }
+    while (code < max_offset && decode(min, max, code + 1) <= value) {
+        ++code;
+    }
+    return code;
+}
+
+//the least code that does not decode below the value
+template <typename Offset>
+Offset PointSet<Offset>::encode_up(double min, double max, double value)
+{
+    if (!(max > min)) {
+        return 0;
+    }
+    double estimate = std::ceil((value - min) / (max - min) * max_offset);
+    Offset code = static_cast<Offset>(std::clamp(estimate, 0.0, static_cast<double>(max_offset)));
+    while (code < max_offset && decode(min, max, code) < value) {
+        ++code;
+    }
+    while (code > 0 && decode(min, max, code - 1) >= value) {
+        --code;
+    }
+    return code;
+}
+
+template <typename Offset>
+Rect PointSet<Offset>::decode(const Rect & parent, const Box & box)
+{
+    return Rect(
+            Point(decode(parent.xmin(), parent.xmax(), box[0]), decode(parent.ymin(), parent.ymax(), box[1])),
+            Point(decode(parent.xmin(), parent.xmax(), box[2]), decode(parent.ymin(), parent.ymax(), box[3])));
+}
+
+template <typename Offset>
+Rect PointSet<Offset>::decode_cell(const Rect & leaf, const std::array<Offset, 2> & code)
+{
+    Offset x_next = (code[0] == max_offset ? code[0] : code[0] + 1);
+    Offset y_next = (code[1] == max_offset ? code[1] : code[1] + 1);
+    return Rect(
+            Point(decode(leaf.xmin(), leaf.xmax(), code[0]), decode(leaf.ymin(), leaf.ymax(), code[1])),
+            Point(decode(leaf.xmin(), leaf.xmax(), x_next), decode(leaf.ymin(), leaf.ymax(), y_next)));
+}
+
+//nodes are laid out as an implicit tree: the children of node i are 2i + 1 and 2i + 2,
+//the left one always takes the lower half of the points
+template <typename Offset>
+void PointSet<Offset>::build(std::size_t node, std::size_t first, std::size_t count, const Rect & parent, bool depth)
+{
+    auto [min_x, max_x] = std::minmax_element(m_points.begin() + first, m_points.begin() + first + count, [](const Point & a, const Point & b) { return a.x() < b.x(); });
+    auto [min_y, max_y] = std::minmax_element(m_points.begin() + first, m_points.begin() + first + count, [](const Point & a, const Point & b) { return a.y() < b.y(); });
+    m_nodes[node] = {
+            encode_down(parent.xmin(), parent.xmax(), min_x->x()),
+            encode_down(parent.ymin(), parent.ymax(), min_y->y()),
+            encode_up(parent.xmin(), parent.xmax(), max_x->x()),
+            encode_up(parent.ymin(), parent.ymax(), max_y->y())};
+    Rect box = decode(parent, m_nodes[node]);
+
+    if (count <= leaf_size) {
+        for (std::size_t i = first; i < first + count; ++i) {
+            m_codes[i] = {encode_down(box.xmin(), box.xmax(), m_points[i].x()), encode_down(box.ymin(), box.ymax(), m_points[i].y())};
+        }
+        m_error = std::max({m_error, (box.xmax() - box.xmin()) / max_offset, (box.ymax() - box.ymin()) / max_offset});
+        return;
+    }
+    std::nth_element(m_points.begin() + first, m_points.begin() + first + count / 2, m_points.begin() + first + count,
+                     [depth](const Point & a, const Point & b) { return kdtree::less(a, b, depth); });
+    build(2 * node + 1, first, count / 2, box, !depth);
+    build(2 * node + 2, first + count / 2, count - count / 2, box, !depth);
+}
+
+template <typename Offset>
+Point PointSet<Offset>::exact(std::size_t index) const
+{
+    if (!m_exact.is_open()) {
+        return m_points[index];
+    }
+    double coords[2];
+    m_exact.seekg(index * sizeof(coords));
+    m_exact.read(reinterpret_cast<char *>(coords), sizeof(coords));
+    return Point(coords[0], coords[1]);
+}
+
+//a subtree is contiguous, so reporting it from the file takes a single read
+template <typename Offset>
+void PointSet<Offset>::exact(std::size_t first, std::size_t count, std::vector<Point> & result) const
+{
+    if (!m_exact.is_open()) {
+        result.insert(result.end(), m_points.begin() + first, m_points.begin() + first + count);
+        return;
+    }
+    std::vector<double> coords(2 * count);
+    m_exact.seekg(first * 2 * sizeof(double));
+    m_exact.read(reinterpret_cast<char *>(coords.data()), coords.size() * sizeof(double));
+    for (std::size_t i = 0; i < count; ++i) {
+        result.push_back(Point(coords[2 * i], coords[2 * i + 1]));
+    }
+}
+
+template <typename Offset>
+void PointSet<Offset>::constructor_impl(std::vector<Point> input, const std::string & exact_file) //NOLINT "input can have const qualifier" -- we change its order via std::unique
+{
+    std::sort(input.begin(), input.end());
+    input.erase(std::unique(input.begin(), input.end()), input.end());
+    if (input.empty()) {
+        return;
+    }
+    m_points = std::move(input);
+    m_codes.resize(m_points.size());
+
+    auto [min_x, max_x] = std::minmax_element(m_points.begin(), m_points.end(), [](const Point & a, const Point & b) { return a.x() < b.x(); });
+    auto [min_y, max_y] = std::minmax_element(m_points.begin(), m_points.end(), [](const Point & a, const Point & b) { return a.y() < b.y(); });
+    m_bounds = Rect(Point(min_x->x(), min_y->y()), Point(max_x->x(), max_y->y()));
+
+    //the right half is never smaller than the left one, so it decides how deep the tree goes
+    std::size_t levels = 0;
+    for (std::size_t count = m_points.size(); count > leaf_size; count -= count / 2) {
+        ++levels;
+    }
+    m_nodes.resize((std::size_t(2) << levels) - 1);
+    m_size = m_points.size();
+    build(0, 0, m_size, *m_bounds, true);
+
+    if (!exact_file.empty()) {
+        {
+            std::ofstream file(exact_file, std::ios::binary | std::ios::trunc);
+            for (const Point & point : m_points) {
+                double coords[2] = {point.x(), point.y()};
+                file.write(reinterpret_cast<const char *>(coords), sizeof(coords));
+            }
+            assert(file.good());
+        }
+        std::vector<Point>().swap(m_points);
+        m_exact.open(exact_file, std::ios::binary);
+        assert(m_exact.good());
+    }
+}
+
+template <typename Offset>
+PointSet<Offset>::PointSet(const std::string & filename, const std::string & exact_file)
+{
+    if (!filename.empty()) {
+        std::ifstream file(filename);
+        assert(file.good());
+        std::vector<Point> input;
+        while (!file.eof()) {
+            double x, y;
+            file >> x >> y;
+            input.push_back(Point(x, y));
+        }
+        constructor_impl(std::move(input), exact_file);
+    }
+}
+
+template <typename Offset>
+PointSet<Offset>::PointSet(std::vector<Point> points, const std::string & exact_file)
+{
+    constructor_impl(std::move(points), exact_file);
+}
+
+template <typename Offset>
+bool PointSet<Offset>::empty() const
+{
+    return m_size == 0;
+}
+
+template <typename Offset>
+std::size_t PointSet<Offset>::size() const
+{
+    return m_size;
+}
+
+template <typename Offset>
+double PointSet<Offset>::error_bound() const
+{
+    return m_error;
+}
+
+template <typename Offset>
+std::size_t PointSet<Offset>::memory_usage() const
+{
+    return m_nodes.capacity() * sizeof(Box) + m_codes.capacity() * sizeof(std::array<Offset, 2>) + m_points.capacity() * sizeof(Point);
+}
+
+template <typename Offset>
+bool PointSet<Offset>::contains_impl(std::size_t node, std::size_t first, std::size_t count, const Rect & box, const Point & point) const
+{
+    if (!box.contains(point)) {
+        return false;
+    }
+    if (count <= leaf_size) {
+        for (std::size_t i = first; i < first + count; ++i) {
+            if (decode_cell(box, m_codes[i]).contains(point) && exact(i) == point) {
+                return true;
+            }
+        }
+        return false;
+    }
+    return contains_impl(2 * node + 1, first, count / 2, decode(box, m_nodes[2 * node + 1]), point) ||
+            contains_impl(2 * node + 2, first + count / 2, count - count / 2, decode(box, m_nodes[2 * node + 2]), point);
+}
+
+template <typename Offset>
+bool PointSet<Offset>::contains(const Point & point) const
+{
+    return !empty() && contains_impl(0, 0, size(), decode(*m_bounds, m_nodes[0]), point);
+}
+
+template <typename Offset>
+void PointSet<Offset>::search_range(std::size_t node, std::size_t first, std::size_t count, const Rect & box, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result) const
+{
+    if (!rect.intersects(box)) {
+        return;
+    }
+    if (rect.contains(box)) {
+        exact(first, count, *result);
+        return;
+    }
+    if (count <= leaf_size) {
+        for (std::size_t i = first; i < first + count; ++i) {
+            Rect cell = decode_cell(box, m_codes[i]);
+            //only the cells on the border of the rectangle need the exact point
+            if (rect.contains(cell)) {
+                result->push_back(exact(i));
+            }
+            else if (rect.intersects(cell)) {
+                Point point = exact(i);
+                if (rect.contains(point)) {
+                    result->push_back(point);
+                }
+            }
+        }
+        return;
+    }
+    search_range(2 * node + 1, first, count / 2, decode(box, m_nodes[2 * node + 1]), rect, result);
+    search_range(2 * node + 2, first + count / 2, count - count / 2, decode(box, m_nodes[2 * node + 2]), rect, result);
+}
+
+template <typename Offset>
+std::pair<typename PointSet<Offset>::iterator, typename PointSet<Offset>::iterator> PointSet<Offset>::range(const Rect & rect) const
+{
+    std::shared_ptr<std::vector<Point>> result = std::make_shared<std::vector<Point>>();
+    if (!empty()) {
+        search_range(0, 0, size(), decode(*m_bounds, m_nodes[0]), rect, result);
+    }
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+//the heap keeps the k best candidates, a quantized cell that can't beat the worst of them is skipped without reading the exact point
+template <typename Offset>
+void PointSet<Offset>::nearest_impl(std::size_t node, std::size_t first, std::size_t count, const Rect & box, const Point & point, std::size_t k, std::vector<std::pair<double, Point>> & heap) const
+{
+    if (heap.size() == k && box.distance(point) >= heap.front().first) {
+        return;
+    }
+    if (count <= leaf_size) {
+        for (std::size_t i = first; i < first + count; ++i) {
+            if (heap.size() == k && decode_cell(box, m_codes[i]).distance(point) >= heap.front().first) {
+                continue;
+            }
+            Point candidate = exact(i);
+            heap.push_back({point.distance(candidate), candidate});
+            std::push_heap(heap.begin(), heap.end());
+            if (heap.size() > k) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.pop_back();
+            }
+        }
+        return;
+    }
+    Rect left = decode(box, m_nodes[2 * node + 1]);
+    Rect right = decode(box, m_nodes[2 * node + 2]);
+    if (left.distance(point) <= right.distance(point)) {
+        nearest_impl(2 * node + 1, first, count / 2, left, point, k, heap);
+        nearest_impl(2 * node + 2, first + count / 2, count - count / 2, right, point, k, heap);
+    }
+    else {
+        nearest_impl(2 * node + 2, first + count / 2, count - count / 2, right, point, k, heap);
+        nearest_impl(2 * node + 1, first, count / 2, left, point, k, heap);
+    }
+}
+
+template <typename Offset>
+std::optional<Point> PointSet<Offset>::nearest(const Point & point) const
+{
+    if (empty()) {
+        return {};
+    }
+    std::vector<std::pair<double, Point>> heap;
+    nearest_impl(0, 0, size(), decode(*m_bounds, m_nodes[0]), point, 1, heap);
+    return heap.front().second;
+}
+
+template <typename Offset>
+std::pair<typename PointSet<Offset>::iterator, typename PointSet<Offset>::iterator> PointSet<Offset>::nearest(const Point & p, std::size_t k) const
+{
+    std::shared_ptr<std::vector<std::pair<double, Point>>> result = std::make_shared<std::vector<std::pair<double, Point>>>();
+    if (!empty() && k != 0) {
+        nearest_impl(0, 0, size(), decode(*m_bounds, m_nodes[0]), p, k, *result);
+    }
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+template class PointSet<std::uint16_t>;
+template class PointSet<std::uint32_t>;
+
+} // namespace compact
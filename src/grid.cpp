@@ -0,0 +1,295 @@
+#include "primitives.h"
+
+namespace grid {
+
+PointSet::PointSet(const std::string & filename)
+{
+    if (!filename.empty()) {
+        std::ifstream file(filename);
+        assert(file.good());
+        while (!file.eof()) {
+            double x, y;
+            file >> x >> y;
+            put(Point(x, y));
+        }
+    }
+}
+
+//indices are clamped, so the cells at the edge of the range also take the points beyond it; nothing is lost,
+//since a point of such a cell is only ever farther than the cell claims
+PointSet::cell PointSet::cell_of(const Point & point) const
+{
+    auto index = [this](double offset) {
+        return static_cast<std::int64_t>(std::clamp(std::floor(offset / m_cell_size), -max_cell_index, max_cell_index));
+    };
+    return {index(point.x() - m_origin.x()), index(point.y() - m_origin.y())};
+}
+
+const std::vector<Point> * PointSet::find_cell(const cell & c) const
+{
+    auto found = m_cells.find(c);
+    return (found == m_cells.end() ? nullptr : &found->second);
+}
+
+//the bounding box would let a single stray point stretch the cells over the whole set, so the farthest points on
+//each side are left out, and an average cell of that extent holds points_per_cell points
+double PointSet::occupied_cell_size() const
+{
+    std::size_t trim = size() / 32;
+    auto extent = [trim](std::vector<double> & coords) {
+        std::nth_element(coords.begin(), coords.begin() + trim, coords.end());
+        double low = coords[trim];
+        std::nth_element(coords.begin() + trim, coords.end() - 1 - trim, coords.end());
+        return coords[coords.size() - 1 - trim] - low;
+    };
+    std::vector<double> xs;
+    std::vector<double> ys;
+    xs.reserve(size());
+    ys.reserve(size());
+    for (const Point & point : m_points) {
+        xs.push_back(point.x());
+        ys.push_back(point.y());
+    }
+    double width = extent(xs);
+    double height = extent(ys);
+    double cells = std::max(1.0, size() / points_per_cell);
+    //a long and thin cloud would otherwise get far more cells along its long side than there are points
+    return std::max(std::sqrt(width * height / cells), std::max(width, height) / cells);
+}
+
+void PointSet::rehash()
+{
+    m_origin = m_bounds->get_bottom_left();
+    m_cells.clear();
+    m_cells.reserve(static_cast<std::size_t>(size() / points_per_cell) + 1);
+    for (const Point & point : m_points) {
+        m_cells[cell_of(point)].push_back(point);
+    }
+}
+
+//empty cells cost nothing in the table, so the cells are shrunk until the occupied ones are not crowded;
+//a cluster that can't be split at all only raises the bar for the next rebuild
+void PointSet::rebuild()
+{
+    double cell_size = occupied_cell_size();
+    if (cell_size > 0) {
+        m_cell_size = cell_size;
+    }
+    rehash();
+    for (int i = 0; i < max_refinements && size() > crowded_cell * m_cells.size(); ++i) {
+        m_cell_size /= 2;
+        rehash();
+    }
+    std::size_t fullest = 0;
+    for (const auto & [c, points] : m_cells) {
+        fullest = std::max(fullest, points.size());
+    }
+    m_overfull_at = std::max(overfull_cell, 2 * fullest);
+    m_rebuild_at = 2 * size();
+}
+
+std::pair<std::int64_t, std::int64_t> PointSet::rings(const cell & center) const
+{
+    cell low = cell_of(m_bounds->get_bottom_left());
+    cell high = cell_of(m_bounds->get_top_right());
+    std::int64_t first = std::max({std::int64_t(0), low.first - center.first, center.first - high.first, low.second - center.second, center.second - high.second});
+    std::int64_t last = std::max({center.first - low.first, high.first - center.first, center.second - low.second, high.second - center.second});
+    return std::make_pair(first, last);
+}
+
+double PointSet::ring_size(const cell & center, std::int64_t radius) const
+{
+    cell low = cell_of(m_bounds->get_bottom_left());
+    cell high = cell_of(m_bounds->get_top_right());
+    if (radius == 0) {
+        return 1;
+    }
+    auto inside = [](std::int64_t coord, std::int64_t min, std::int64_t max) { return min <= coord && coord <= max; };
+    double row = std::max<std::int64_t>(0, std::min(center.first + radius, high.first) - std::max(center.first - radius, low.first) + 1);
+    double column = std::max<std::int64_t>(0, std::min(center.second + radius - 1, high.second) - std::max(center.second - radius + 1, low.second) + 1);
+    return row * (inside(center.second - radius, low.second, high.second) + inside(center.second + radius, low.second, high.second)) +
+            column * (inside(center.first - radius, low.first, high.first) + inside(center.first + radius, low.first, high.first));
+}
+
+template <typename F, typename Done>
+void PointSet::search_around(const cell & center, F && f, Done && done) const
+{
+    auto [first_ring, last_ring] = rings(center);
+    double looked_up = 0;
+    for (std::int64_t radius = first_ring; radius <= last_ring; ++radius) {
+        looked_up += ring_size(center, radius);
+        if (looked_up > m_cells.size() / 4) {
+            //the rings inside this one are done, and a point `distance` rings away is at least distance - 1 cells away
+            for (const Point & point : m_points) {
+                cell c = cell_of(point);
+                std::int64_t distance = std::max(std::abs(c.first - center.first), std::abs(c.second - center.second));
+                if (distance >= radius && !done(distance - 1)) {
+                    f(point);
+                }
+            }
+            return;
+        }
+        for_each_in_ring(center, radius, f);
+        if (done(radius)) {
+            return;
+        }
+    }
+}
+
+template <typename F>
+void PointSet::for_each_in_ring(const cell & center, std::int64_t radius, F && f) const
+{
+    cell low = cell_of(m_bounds->get_bottom_left());
+    cell high = cell_of(m_bounds->get_top_right());
+    auto visit = [&](std::int64_t x, std::int64_t y) {
+        if (low.first <= x && x <= high.first && low.second <= y && y <= high.second) {
+            if (const std::vector<Point> * points = find_cell({x, y})) {
+                for (const Point & point : *points) {
+                    f(point);
+                }
+            }
+        }
+    };
+    if (radius == 0) {
+        visit(center.first, center.second);
+        return;
+    }
+    for (std::int64_t x = std::max(center.first - radius, low.first); x <= std::min(center.first + radius, high.first); ++x) {
+        visit(x, center.second - radius);
+        visit(x, center.second + radius);
+    }
+    for (std::int64_t y = std::max(center.second - radius + 1, low.second); y < std::min(center.second + radius, high.second + 1); ++y) {
+        visit(center.first - radius, y);
+        visit(center.first + radius, y);
+    }
+}
+
+bool PointSet::empty() const
+{
+    return m_points.empty();
+}
+
+std::size_t PointSet::size() const
+{
+    return m_points.size();
+}
+
+void PointSet::put(const Point & point)
+{
+    if (contains(point)) {
+        return;
+    }
+    if (!m_bounds) {
+        m_bounds = Rect(point, point);
+        m_origin = point;
+    }
+    else {
+        m_bounds = Rect(Point(std::min(m_bounds->xmin(), point.x()), std::min(m_bounds->ymin(), point.y())),
+                        Point(std::max(m_bounds->xmax(), point.x()), std::max(m_bounds->ymax(), point.y())));
+    }
+    m_points.push_back(point);
+    std::vector<Point> & points = m_cells[cell_of(point)];
+    points.push_back(point);
+    //a crowded cell makes every put into it linear
+    if (size() >= m_rebuild_at || points.size() > m_overfull_at) {
+        rebuild();
+    }
+}
+
+bool PointSet::contains(const Point & point) const
+{
+    if (empty()) {
+        return false;
+    }
+    const std::vector<Point> * points = find_cell(cell_of(point));
+    return points != nullptr && std::find(points->begin(), points->end(), point) != points->end();
+}
+
+// second iterator points to an element out of range
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::range(const Rect & rect) const
+{
+    std::shared_ptr<std::vector<Point>> result = std::make_shared<std::vector<Point>>();
+    if (empty() || !rect.intersects(*m_bounds)) {
+        return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+    }
+    cell low = cell_of(Point(std::max(rect.xmin(), m_bounds->xmin()), std::max(rect.ymin(), m_bounds->ymin())));
+    cell high = cell_of(Point(std::min(rect.xmax(), m_bounds->xmax()), std::min(rect.ymax(), m_bounds->ymax())));
+    auto report = [&rect, &result](const std::vector<Point> & points) {
+        for (const Point & point : points) {
+            if (rect.contains(point)) {
+                result->push_back(point);
+            }
+        }
+    };
+    //a huge rectangle covers more cells than there are occupied ones, so it is cheaper to check them all
+    if (static_cast<double>(high.first - low.first + 1) * (high.second - low.second + 1) > m_cells.size()) {
+        for (const auto & [c, points] : m_cells) {
+            if (low.first <= c.first && c.first <= high.first && low.second <= c.second && c.second <= high.second) {
+                report(points);
+            }
+        }
+    }
+    else {
+        for (std::int64_t x = low.first; x <= high.first; ++x) {
+            for (std::int64_t y = low.second; y <= high.second; ++y) {
+                if (const std::vector<Point> * points = find_cell({x, y})) {
+                    report(*points);
+                }
+            }
+        }
+    }
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+PointSet::iterator PointSet::begin() const
+{
+    return iterator(this, m_points.begin());
+}
+
+PointSet::iterator PointSet::end() const
+{
+    return iterator(this, m_points.end());
+}
+
+//rings of cells are visited around the point until the next ring can't be closer than the answer
+std::optional<Point> PointSet::nearest(const Point & point) const
+{
+    if (empty()) {
+        return {};
+    }
+    std::optional<Point> result;
+    double best = std::numeric_limits<double>::infinity();
+    search_around(
+            cell_of(point),
+            [&](const Point & candidate) {
+                if (point.distance(candidate) < best) {
+                    best = point.distance(candidate);
+                    result = candidate;
+                }
+            },
+            [&](std::int64_t radius) { return best <= radius * m_cell_size; });
+    return result;
+}
+
+// second iterator points to an element out of range
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::nearest(const Point & p, std::size_t k) const
+{
+    std::shared_ptr<std::vector<std::pair<double, Point>>> result = std::make_shared<std::vector<std::pair<double, Point>>>();
+    if (empty() || k == 0) {
+        return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+    }
+    search_around(
+            cell_of(p),
+            [&](const Point & candidate) {
+                result->push_back({p.distance(candidate), candidate});
+                std::push_heap(result->begin(), result->end());
+                if (result->size() > k) {
+                    std::pop_heap(result->begin(), result->end());
+                    result->pop_back();
+                }
+            },
+            [&](std::int64_t radius) { return result->size() == k && result->front().first <= radius * m_cell_size; });
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+} // namespace grid
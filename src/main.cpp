@@ -29,13 +29,45 @@ void test(T & set)
     std::cout << set << std::endl;
 }
 
+//a stray point far from the rest must not pile them all into one cell
+template <typename T>
+void test_outlier(T & set)
+{
+    set.put({1000, 1000});
+    for (double i = 0; i < 200; ++i) {
+        for (double j = 0; j < 200; ++j) {
+            set.put({i / 200, j / 200});
+        }
+    }
+    assert(set.size() == 40001);
+    for (double i = 0; i < 200; ++i) {
+        assert(set.contains({i / 200, (199 - i) / 200}));
+    }
+    std::cout << "Next line must contain 0.5 0.5 and 1000 1000." << std::endl;
+    std::cout << *set.nearest({0.501, 0.501}) << "; " << *set.nearest({700, 900}) << "; " << '\n';
+    auto [first, last] = set.nearest({-0.2, 0.5}, 3);
+    std::cout << "Next line must contain dots 0 0.495, 0 0.5 and 0 0.505." << std::endl;
+    while (first != last) {
+        std::cout << *first << "; ";
+        first++;
+    }
+    std::cout << '\n';
+}
+
 int main()
 {
     rbtree::PointSet rb;
     kdtree::PointSet kd;
+    grid::PointSet gr;
     std::cout << "Testing rb-tree:" << std::endl;
     test(rb);
     std::cout << "#################################################" << '\n';
     std::cout << "Testing kd-tree:" << std::endl;
     test(kd);
+    std::cout << "#################################################" << '\n';
+    std::cout << "Testing grid:" << std::endl;
+    test(gr);
+    grid::PointSet outlier;
+    std::cout << "Testing grid with an outlier:" << std::endl;
+    test_outlier(outlier);
 }
@@ -0,0 +1,397 @@
+#include "primitives.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+namespace paged {
+
+namespace {
+
+const char magic[8] = {'K', 'D', 'P', 'A', 'G', 'E', 'D', '1'};
+
+void write_point(std::ostream & stream, const Point & point)
+{
+    double coords[2] = {point.x(), point.y()};
+    stream.write(reinterpret_cast<const char *>(coords), sizeof(coords));
+}
+
+bool read_point(std::istream & stream, Point & point)
+{
+    double coords[2];
+    if (!stream.read(reinterpret_cast<char *>(coords), sizeof(coords))) {
+        return false;
+    }
+    point = Point(coords[0], coords[1]);
+    return true;
+}
+
+} // namespace
+
+// writes the nodes straight into the output file and the points into a side file appended at the end;
+// nodes are numbered in preorder, and a subtree small enough to fit in a page is never split between two
+class PointSet::Builder
+{
+private:
+    std::string m_output;
+    // how many points may be loaded at once
+    std::size_t m_memory_limit;
+    std::fstream m_nodes;
+    std::ofstream m_points;
+    std::uint32_t m_next_node = 0;
+    std::uint32_t m_next_point = 0;
+    std::size_t m_next_file = 0;
+
+    std::string temp_name()
+    {
+        return m_output + ".tmp" + std::to_string(m_next_file++);
+    }
+
+    static std::size_t subtree_nodes(std::size_t count)
+    {
+        return (count <= leaf_size ? 1 : 1 + subtree_nodes(count / 2) + subtree_nodes(count - count / 2));
+    }
+
+    std::uint32_t allocate(std::size_t count)
+    {
+        std::size_t remaining = nodes_per_page - m_next_node % nodes_per_page;
+        if (count <= nodes_per_page * leaf_size) {
+            std::size_t nodes = subtree_nodes(count);
+            if (nodes <= nodes_per_page && nodes > remaining) {
+                m_next_node += remaining;
+            }
+        }
+        return m_next_node++;
+    }
+
+    void write(std::uint32_t id, const Node & node)
+    {
+        m_nodes.seekp(page_size * (1 + id / nodes_per_page) + (id % nodes_per_page) * sizeof(Node));
+        m_nodes.write(reinterpret_cast<const char *>(&node), sizeof(Node));
+    }
+
+    static Node join(const Node & left, const Node & right, std::uint32_t left_id, std::uint32_t right_id)
+    {
+        return {std::min(left.xmin, right.xmin), std::min(left.ymin, right.ymin), std::max(left.xmax, right.xmax), std::max(left.ymax, right.ymax),
+                left_id, right_id, left.first, left.count + right.count};
+    }
+
+public:
+    Builder(const std::string & output, std::size_t memory_limit)
+        : m_output(output)
+        , m_memory_limit(std::max<std::size_t>(memory_limit / sizeof(Point), 2 * leaf_size))
+        , m_nodes(output, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc)
+        , m_points(output + ".points", std::ios::binary | std::ios::trunc)
+    {
+        assert(m_nodes.good() && m_points.good());
+    }
+
+    std::pair<std::uint32_t, Node> build_memory(std::vector<Point>::iterator start, std::vector<Point>::iterator finish, bool depth)
+    {
+        std::size_t count = finish - start;
+        std::uint32_t id = allocate(count);
+        Node node;
+        if (count <= leaf_size) {
+            auto [min_x, max_x] = std::minmax_element(start, finish, [](const Point & a, const Point & b) { return a.x() < b.x(); });
+            auto [min_y, max_y] = std::minmax_element(start, finish, [](const Point & a, const Point & b) { return a.y() < b.y(); });
+            node = {min_x->x(), min_y->y(), max_x->x(), max_y->y(), no_child, no_child, m_next_point, static_cast<std::uint32_t>(count)};
+            for (auto iter = start; iter != finish; ++iter) {
+                write_point(m_points, *iter);
+            }
+            m_next_point += count;
+        }
+        else {
+            auto median = start + count / 2;
+            std::nth_element(start, median, finish, [depth](const Point & a, const Point & b) { return kdtree::less(a, b, depth); });
+            auto [left_id, left] = build_memory(start, median, !depth);
+            auto [right_id, right] = build_memory(median, finish, !depth);
+            node = join(left, right, left_id, right_id);
+        }
+        write(id, node);
+        return std::make_pair(id, node);
+    }
+
+    //a segment that does not fit in memory is cut at the median of a sample and written into two smaller ones
+    std::pair<std::uint32_t, Node> build_file(const std::string & segment, std::size_t count, bool depth)
+    {
+        std::vector<Point> points;
+        Point key(0, 0);
+        std::size_t left_count = 0;
+        std::string left_name = temp_name();
+        std::string right_name = temp_name();
+        if (count > m_memory_limit) {
+            std::ifstream input(segment, std::ios::binary);
+            std::mt19937_64 random(count);
+            std::size_t sample_size = std::min<std::size_t>(m_memory_limit, 1 << 16);
+            Point point(0, 0);
+            for (std::size_t seen = 0; read_point(input, point); ++seen) {
+                if (points.size() < sample_size) {
+                    points.push_back(point);
+                }
+                else if (std::size_t slot = std::uniform_int_distribution<std::size_t>(0, seen)(random); slot < sample_size) {
+                    points[slot] = point;
+                }
+            }
+            std::nth_element(points.begin(), points.begin() + points.size() / 2, points.end(), [depth](const Point & a, const Point & b) { return kdtree::less(a, b, depth); });
+            key = points[points.size() / 2];
+            points.clear();
+
+            input.clear();
+            input.seekg(0);
+            std::ofstream left(left_name, std::ios::binary);
+            std::ofstream right(right_name, std::ios::binary);
+            while (read_point(input, point)) {
+                bool goes_left = !kdtree::less(key, point, depth);
+                write_point(goes_left ? left : right, point);
+                left_count += goes_left;
+            }
+        }
+        //a cut that leaves one side empty means the segment is mostly one repeated point, which deduplication will shrink
+        if (count <= m_memory_limit || left_count == 0 || left_count == count) {
+            std::remove(left_name.c_str());
+            std::remove(right_name.c_str());
+            std::ifstream input(segment, std::ios::binary);
+            Point point(0, 0);
+            while (read_point(input, point)) {
+                points.push_back(point);
+            }
+            input.close();
+            std::remove(segment.c_str());
+            std::sort(points.begin(), points.end());
+            points.erase(std::unique(points.begin(), points.end()), points.end());
+            return build_memory(points.begin(), points.end(), depth);
+        }
+        std::remove(segment.c_str());
+
+        std::uint32_t id = allocate(count);
+        auto [left_id, left] = build_file(left_name, left_count, !depth);
+        auto [right_id, right] = build_file(right_name, count - left_count, !depth);
+        Node node = join(left, right, left_id, right_id);
+        write(id, node);
+        return std::make_pair(id, node);
+    }
+
+    void build(const std::string & input)
+    {
+        std::ifstream text(input);
+        assert(text.good());
+        std::string segment = temp_name();
+        std::size_t count = 0;
+        {
+            std::ofstream binary(segment, std::ios::binary);
+            double x, y;
+            while (text >> x >> y) {
+                write_point(binary, Point(x, y));
+                ++count;
+            }
+        }
+
+        Header header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.root = no_child;
+        if (count != 0) {
+            header.root = build_file(segment, count, true).first;
+        }
+        else {
+            std::remove(segment.c_str());
+        }
+        header.size = m_next_point;
+        header.node_pages = (m_next_node + nodes_per_page - 1) / nodes_per_page;
+
+        m_points.close();
+        std::ifstream points(m_output + ".points", std::ios::binary);
+        m_nodes.seekp(page_size * (1 + header.node_pages));
+        if (header.size != 0) {
+            m_nodes << points.rdbuf();
+        }
+        points.close();
+        std::remove((m_output + ".points").c_str());
+
+        m_nodes.seekp(0);
+        m_nodes.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        m_nodes.close();
+    }
+};
+
+void PointSet::build(const std::string & input, const std::string & output, std::size_t memory_limit)
+{
+    Builder(output, memory_limit).build(input);
+}
+
+PointSet::PointSet(const std::string & filename, std::size_t memory_limit)
+    : m_file(filename, std::ios::binary)
+    , m_capacity(std::max<std::size_t>(memory_limit / page_size, 1))
+{
+    assert(m_file.good());
+    m_file.read(reinterpret_cast<char *>(&m_header), sizeof(m_header));
+    assert(m_file.good() && std::memcmp(m_header.magic, magic, sizeof(magic)) == 0);
+}
+
+//the least recently used page is dropped when the cache is full
+const char * PointSet::page(std::size_t index) const
+{
+    auto found = m_cache.find(index);
+    if (found != m_cache.end()) {
+        ++m_stats.cache_hits;
+        m_lru.splice(m_lru.begin(), m_lru, found->second.second);
+        return found->second.first.data();
+    }
+    std::vector<char> data(page_size);
+    if (m_cache.size() >= m_capacity) {
+        auto evicted = m_cache.find(m_lru.back());
+        data = std::move(evicted->second.first);
+        m_cache.erase(evicted);
+        m_lru.pop_back();
+    }
+    ++m_stats.page_reads;
+    m_file.clear();
+    m_file.seekg(index * page_size);
+    m_file.read(data.data(), page_size);
+    m_lru.push_front(index);
+    return m_cache.emplace(index, std::make_pair(std::move(data), m_lru.begin())).first->second.first.data();
+}
+
+PointSet::Node PointSet::node(std::uint32_t id) const
+{
+    Node result;
+    std::memcpy(&result, page(1 + id / nodes_per_page) + (id % nodes_per_page) * sizeof(Node), sizeof(Node));
+    return result;
+}
+
+Rect PointSet::region(const Node & cur)
+{
+    return Rect(Point(cur.xmin, cur.ymin), Point(cur.xmax, cur.ymax));
+}
+
+Point PointSet::point(std::size_t index) const
+{
+    double coords[2];
+    std::memcpy(coords, page(1 + m_header.node_pages + index / points_per_page) + (index % points_per_page) * sizeof(coords), sizeof(coords));
+    return Point(coords[0], coords[1]);
+}
+
+bool PointSet::empty() const
+{
+    return m_header.size == 0;
+}
+
+std::size_t PointSet::size() const
+{
+    return m_header.size;
+}
+
+PointSet::IoStats PointSet::stats() const
+{
+    return m_stats;
+}
+
+void PointSet::reset_stats()
+{
+    m_stats = {};
+}
+
+void PointSet::report_subtree(const Node & cur, const std::shared_ptr<std::vector<Point>> & result) const
+{
+    for (std::size_t i = cur.first; i < cur.first + cur.count; ++i) {
+        result->push_back(point(i));
+    }
+}
+
+void PointSet::search_range(const Node & cur, const Rect & rect, const std::shared_ptr<std::vector<Point>> & result) const
+{
+    if (!rect.intersects(region(cur))) {
+        return;
+    }
+    if (rect.contains(region(cur))) {
+        report_subtree(cur, result);
+    }
+    else if (cur.left == no_child) {
+        for (std::size_t i = cur.first; i < cur.first + cur.count; ++i) {
+            Point candidate = point(i);
+            if (rect.contains(candidate)) {
+                result->push_back(candidate);
+            }
+        }
+    }
+    else {
+        search_range(node(cur.left), rect, result);
+        search_range(node(cur.right), rect, result);
+    }
+}
+
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::range(const Rect & rect) const
+{
+    std::shared_ptr<std::vector<Point>> result = std::make_shared<std::vector<Point>>();
+    if (!empty()) {
+        search_range(node(m_header.root), rect, result);
+    }
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+bool PointSet::contains_impl(const Node & cur, const Point & p) const
+{
+    if (!region(cur).contains(p)) {
+        return false;
+    }
+    if (cur.left == no_child) {
+        for (std::size_t i = cur.first; i < cur.first + cur.count; ++i) {
+            if (point(i) == p) {
+                return true;
+            }
+        }
+        return false;
+    }
+    return contains_impl(node(cur.left), p) || contains_impl(node(cur.right), p);
+}
+
+bool PointSet::contains(const Point & p) const
+{
+    return !empty() && contains_impl(node(m_header.root), p);
+}
+
+void PointSet::nearest_impl(const Node & cur, const Point & p, std::size_t k, std::vector<std::pair<double, Point>> & heap) const
+{
+    if (heap.size() == k && region(cur).distance(p) >= heap.front().first) {
+        return;
+    }
+    if (cur.left == no_child) {
+        for (std::size_t i = cur.first; i < cur.first + cur.count; ++i) {
+            Point candidate = point(i);
+            heap.push_back({p.distance(candidate), candidate});
+            std::push_heap(heap.begin(), heap.end());
+            if (heap.size() > k) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.pop_back();
+            }
+        }
+        return;
+    }
+    Node left = node(cur.left);
+    Node right = node(cur.right);
+    if (region(left).distance(p) > region(right).distance(p)) {
+        std::swap(left, right);
+    }
+    nearest_impl(left, p, k, heap);
+    nearest_impl(right, p, k, heap);
+}
+
+std::optional<Point> PointSet::nearest(const Point & p) const
+{
+    if (empty()) {
+        return {};
+    }
+    std::vector<std::pair<double, Point>> heap;
+    nearest_impl(node(m_header.root), p, 1, heap);
+    return heap.front().second;
+}
+
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::nearest(const Point & p, std::size_t k) const
+{
+    std::shared_ptr<std::vector<std::pair<double, Point>>> result = std::make_shared<std::vector<std::pair<double, Point>>>();
+    if (!empty() && k != 0) {
+        nearest_impl(node(m_header.root), p, k, *result);
+    }
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+} // namespace paged
@@ -64,18 +64,5 @@ bool Rect::contains(const Point & p) const
 
 bool Rect::intersects(const Rect & other) const
 {
-    bool other_left_between_this = xmin() <= other.xmin() && other.xmin() <= xmax();
-    bool other_right_between_this = xmin() <= other.xmax() && other.xmax() <= xmax();
-    bool other_top_between_this = ymin() <= other.ymax() && other.ymax() <= ymax();
-    bool other_bottom_between_this = ymin() <= other.ymin() && other.ymin() <= ymax();
-
-    bool upper_left = other_left_between_this && other_top_between_this;
-    bool upper_right = other_right_between_this && other_top_between_this;
-    bool lower_left = other_left_between_this && other_bottom_between_this;
-    bool lower_right = other_right_between_this && other_bottom_between_this;
-
-    bool cur_is_mid_left = other_right_between_this && other.ymin() <= ymin() && ymax() <= other.ymax();
-    bool cur_is_mid_right = other_left_between_this && other.ymin() <= ymin() && ymax() <= other.ymax();
-
-    return contains(other) || other.contains(*this) || upper_left || upper_right || lower_left || lower_right || cur_is_mid_left || cur_is_mid_right;
+    return xmin() <= other.xmax() && other.xmin() <= xmax() && ymin() <= other.ymax() && other.ymin() <= ymax();
 }
@@ -0,0 +1,117 @@
+#include "primitives.h"
+
+namespace sharded {
+
+PointSet::PointSet(const Rect & bounds, std::size_t columns, std::size_t rows, const std::string & filename)
+    : m_bounds(bounds)
+    , m_columns(std::max<std::size_t>(columns, 1))
+    , m_rows(std::max<std::size_t>(rows, 1))
+    , m_shards(m_columns * m_rows)
+{
+    if (!filename.empty()) {
+        std::ifstream file(filename);
+        assert(file.good());
+        std::vector<std::vector<Point>> input(m_shards.size());
+        while (!file.eof()) {
+            double x, y;
+            file >> x >> y;
+            Point point(x, y);
+            input[shard_index(point)].push_back(point);
+        }
+        //each shard is balanced on its own, as the kd-tree constructor does for the whole set
+        for (std::size_t i = 0; i < m_shards.size(); ++i) {
+            m_shards[i].set = kdtree::PointSet(std::move(input[i]));
+            m_size += m_shards[i].set.size();
+        }
+    }
+}
+
+std::size_t PointSet::shard_index(const Point & point) const
+{
+    auto cell = [](double coord, double min, double max, std::size_t count) -> std::size_t {
+        if (!(coord > min) || !(max > min)) {
+            return 0;
+        }
+        return std::min(static_cast<std::size_t>((coord - min) / (max - min) * count), count - 1);
+    };
+    std::size_t column = cell(point.x(), m_bounds.xmin(), m_bounds.xmax(), m_columns);
+    std::size_t row = cell(point.y(), m_bounds.ymin(), m_bounds.ymax(), m_rows);
+    return row * m_columns + column;
+}
+
+bool PointSet::empty() const
+{
+    return size() == 0;
+}
+
+std::size_t PointSet::size() const
+{
+    return m_size;
+}
+
+void PointSet::put(const Point & point)
+{
+    Shard & shard = m_shards[shard_index(point)];
+    std::lock_guard lock(shard.mutex);
+    std::size_t old_size = shard.set.size();
+    shard.set.put(point);
+    m_size += shard.set.size() - old_size;
+}
+
+bool PointSet::contains(const Point & point) const
+{
+    const Shard & shard = m_shards[shard_index(point)];
+    std::lock_guard lock(shard.mutex);
+    return shard.set.contains(point);
+}
+
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::range(const Rect & rect) const
+{
+    std::shared_ptr<std::vector<Point>> result = std::make_shared<std::vector<Point>>();
+    for (const Shard & shard : m_shards) {
+        std::lock_guard lock(shard.mutex);
+        std::optional<Rect> bounds = shard.set.bounds();
+        if (!bounds || !rect.intersects(*bounds)) {
+            continue;
+        }
+        auto [first, last] = shard.set.range(rect);
+        result->insert(result->end(), first, last);
+    }
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::points() const
+{
+    std::shared_ptr<std::vector<Point>> result = std::make_shared<std::vector<Point>>();
+    for (const Shard & shard : m_shards) {
+        std::lock_guard lock(shard.mutex);
+        result->insert(result->end(), shard.set.begin(), shard.set.end());
+    }
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+std::optional<Point> PointSet::nearest(const Point & point) const
+{
+    auto [first, last] = nearest(point, 1);
+    return (first == last ? std::optional<Point>() : *first);
+}
+
+//shards are searched from the closest one, so the rest are usually cut off by their bounds
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::nearest(const Point & p, std::size_t k) const
+{
+    return kdtree::nearest_of_parts(
+            p,
+            k,
+            m_shards.size(),
+            false,
+            [this](std::size_t i) {
+                std::lock_guard lock(m_shards[i].mutex);
+                return m_shards[i].set.bounds();
+            },
+            [this, &p](std::size_t i, std::size_t count) {
+                std::lock_guard lock(m_shards[i].mutex);
+                return m_shards[i].set.nearest(p, count);
+            });
+}
+
+} // namespace sharded
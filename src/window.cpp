@@ -0,0 +1,104 @@
+#include "primitives.h"
+
+namespace window {
+
+PointSet::PointSet(std::size_t intervals)
+    : m_generations(std::max<std::size_t>(intervals, 1))
+{
+}
+
+bool PointSet::empty() const
+{
+    return size() == 0;
+}
+
+std::size_t PointSet::size() const
+{
+    std::size_t result = 0;
+    for (const kdtree::PointSet & generation : m_generations) {
+        result += generation.size();
+    }
+    return result;
+}
+
+std::size_t PointSet::intervals() const
+{
+    return m_generations.size();
+}
+
+void PointSet::put(const Point & point)
+{
+    m_generations[m_current].put(point);
+}
+
+bool PointSet::contains(const Point & point) const
+{
+    for (const kdtree::PointSet & generation : m_generations) {
+        std::optional<Rect> bounds = generation.bounds();
+        if (bounds && bounds->contains(point) && generation.contains(point)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//the interval filled by puts is rebuilt once with the bulk constructor, the oldest one is dropped without touching its points
+void PointSet::advance()
+{
+    kdtree::PointSet & sealed = m_generations[m_current];
+    sealed = kdtree::PointSet(std::vector<Point>(sealed.begin(), sealed.end()));
+    m_current = (m_current + 1) % m_generations.size();
+    m_generations[m_current] = kdtree::PointSet();
+}
+
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::range(const Rect & rect) const
+{
+    std::shared_ptr<std::vector<Point>> result = std::make_shared<std::vector<Point>>();
+    std::size_t reported = 0;
+    for (const kdtree::PointSet & generation : m_generations) {
+        std::optional<Rect> bounds = generation.bounds();
+        if (!bounds || !rect.intersects(*bounds)) {
+            continue;
+        }
+        auto [first, last] = generation.range(rect);
+        result->insert(result->end(), first, last);
+        ++reported;
+    }
+    //only points seen in more than one interval can repeat
+    if (reported > 1) {
+        std::sort(result->begin(), result->end());
+        result->erase(std::unique(result->begin(), result->end()), result->end());
+    }
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::points() const
+{
+    std::shared_ptr<std::vector<Point>> result = std::make_shared<std::vector<Point>>();
+    for (const kdtree::PointSet & generation : m_generations) {
+        result->insert(result->end(), generation.begin(), generation.end());
+    }
+    std::sort(result->begin(), result->end());
+    result->erase(std::unique(result->begin(), result->end()), result->end());
+    return std::make_pair(iterator(result, result->begin()), iterator(result, result->end()));
+}
+
+std::optional<Point> PointSet::nearest(const Point & point) const
+{
+    auto [first, last] = nearest(point, 1);
+    return (first == last ? std::optional<Point>() : *first);
+}
+
+//a point put in several intervals is found in each of them, so the merge drops the repeats
+std::pair<PointSet::iterator, PointSet::iterator> PointSet::nearest(const Point & p, std::size_t k) const
+{
+    return kdtree::nearest_of_parts(
+            p,
+            k,
+            m_generations.size(),
+            true,
+            [this](std::size_t i) { return m_generations[i].bounds(); },
+            [this, &p](std::size_t i, std::size_t count) { return m_generations[i].nearest(p, count); });
+}
+
+} // namespace window
@@ -0,0 +1,195 @@
+#include "primitives.h"
+#include "protocol.h"
+
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <system_error>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace loadgen {
+
+using clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string path;
+    std::size_t connections = 4;
+    // requests kept in flight on every connection
+    std::size_t depth = 16;
+    double seconds = 5;
+    Rect bounds{{0, 0}, {1, 1}};
+};
+
+int connect_to(const std::string & path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), std::min(path.size(), sizeof(address.sun_path) - 1));
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+        throw std::system_error(errno, std::generic_category(), "connect to " + path);
+    }
+    return fd;
+}
+
+void send_all(int fd, const std::vector<char> & buffer)
+{
+    std::size_t sent = 0;
+    while (sent < buffer.size()) {
+        ssize_t result = send(fd, buffer.data() + sent, buffer.size() - sent, MSG_NOSIGNAL);
+        if (result < 0) {
+            throw std::system_error(errno, std::generic_category(), "send");
+        }
+        sent += result;
+    }
+}
+
+void receive_all(int fd, char * data, std::size_t size)
+{
+    while (size > 0) {
+        ssize_t result = recv(fd, data, size, 0);
+        if (result <= 0) {
+            throw std::system_error(result < 0 ? errno : ECONNRESET, std::generic_category(), "recv");
+        }
+        data += result;
+        size -= result;
+    }
+}
+
+//mostly reads with a few puts; rectangles are about a percent of the bounds on each side
+void append_random_request(std::vector<char> & buffer, std::uint32_t id, const Rect & bounds, std::mt19937 & random)
+{
+    std::uniform_real_distribution<double> x(bounds.xmin(), bounds.xmax());
+    std::uniform_real_distribution<double> y(bounds.ymin(), bounds.ymax());
+    double width = (bounds.xmax() - bounds.xmin()) / 100;
+    double height = (bounds.ymax() - bounds.ymin()) / 100;
+    double px = x(random);
+    double py = y(random);
+    switch (std::uniform_int_distribution<int>(0, 9)(random)) {
+    case 0:
+        protocol::append_request(buffer, id, protocol::Op::put, {px, py});
+        break;
+    case 1:
+    case 2:
+    case 3:
+        protocol::append_request(buffer, id, protocol::Op::contains, {px, py});
+        break;
+    case 4:
+    case 5:
+        protocol::append_request(buffer, id, protocol::Op::range, {px, py, px + width, py + height});
+        break;
+    case 6:
+    case 7:
+        protocol::append_request(buffer, id, protocol::Op::nearest, {px, py});
+        break;
+    default:
+        protocol::append_request(buffer, id, protocol::Op::knn, {px, py}, 8);
+    }
+}
+
+//keeps the pipeline full until the time is up and returns the latency of every answered request
+std::vector<double> run_connection(const Options & options, unsigned seed)
+{
+    int fd = connect_to(options.path);
+    std::mt19937 random(seed);
+    std::deque<std::pair<std::uint32_t, clock::time_point>> in_flight;
+    std::vector<double> latencies;
+    std::vector<char> buffer;
+    std::vector<char> payload;
+    std::uint32_t next_id = 0;
+    clock::time_point deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(options.seconds));
+
+    while (clock::now() < deadline || !in_flight.empty()) {
+        buffer.clear();
+        while (clock::now() < deadline && in_flight.size() < options.depth) {
+            append_random_request(buffer, next_id, options.bounds, random);
+            in_flight.emplace_back(next_id++, clock::now());
+        }
+        send_all(fd, buffer);
+
+        protocol::ResponseHeader header;
+        receive_all(fd, reinterpret_cast<char *>(&header), sizeof(header));
+        payload.resize(header.length);
+        receive_all(fd, payload.data(), payload.size());
+        //a connection is answered in order
+        if (in_flight.empty() || header.id != in_flight.front().first || header.status != protocol::Status::ok) {
+            close(fd);
+            throw std::runtime_error("unexpected response " + std::to_string(header.id));
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(clock::now() - in_flight.front().second).count());
+        in_flight.pop_front();
+    }
+    close(fd);
+    return latencies;
+}
+
+double percentile(const std::vector<double> & sorted, double fraction)
+{
+    return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(fraction * sorted.size()))];
+}
+
+} // namespace loadgen
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <socket path> [connections] [depth] [seconds] [xmin ymin xmax ymax]" << std::endl;
+        return 1;
+    }
+    loadgen::Options options;
+    options.path = argv[1];
+    if (argc > 2) {
+        options.connections = std::stoul(argv[2]);
+    }
+    if (argc > 3) {
+        options.depth = std::max(1UL, std::stoul(argv[3]));
+    }
+    if (argc > 4) {
+        options.seconds = std::stod(argv[4]);
+    }
+    if (argc > 8) {
+        options.bounds = Rect(Point(std::stod(argv[5]), std::stod(argv[6])), Point(std::stod(argv[7]), std::stod(argv[8])));
+    }
+
+    std::vector<std::vector<double>> results(options.connections);
+    std::vector<std::thread> threads;
+    bool failed = false;
+    std::mutex failure;
+    for (std::size_t i = 0; i < options.connections; ++i) {
+        threads.emplace_back([&, i] {
+            try {
+                results[i] = loadgen::run_connection(options, static_cast<unsigned>(i));
+            }
+            catch (const std::exception & e) {
+                std::lock_guard lock(failure);
+                std::cerr << e.what() << std::endl;
+                failed = true;
+            }
+        });
+    }
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+
+    std::vector<double> latencies;
+    for (const std::vector<double> & result : results) {
+        latencies.insert(latencies.end(), result.begin(), result.end());
+    }
+    if (latencies.empty()) {
+        std::cerr << "no requests were answered" << std::endl;
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "requests: " << latencies.size() << '\n'
+              << "throughput: " << latencies.size() / options.seconds << " req/s" << '\n'
+              << "p50: " << loadgen::percentile(latencies, 0.5) << " us" << '\n'
+              << "p99: " << loadgen::percentile(latencies, 0.99) << " us" << '\n'
+              << "max: " << latencies.back() << " us" << std::endl;
+    return failed ? 1 : 0;
+}
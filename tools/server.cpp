@@ -0,0 +1,486 @@
+#include "primitives.h"
+#include "protocol.h"
+
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <iostream>
+#include <shared_mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace server {
+
+int check(int result, const char * what)
+{
+    if (result < 0) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+    return result;
+}
+
+// every complete request read from a connection since its previous batch was answered,
+// so the busier a client pipelines, the larger its batches get
+struct Batch
+{
+    std::uint64_t connection;
+    std::vector<char> requests;
+    std::vector<char> responses;
+};
+
+class WorkerPool
+{
+private:
+    kdtree::PointSet & m_set;
+    std::shared_mutex m_set_mutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<Batch> m_tasks;
+    std::deque<Batch> m_done;
+    bool m_stopped = false;
+    // the reactor is woken up through it when a batch is answered
+    int m_wakeup;
+    std::vector<std::thread> m_threads;
+
+    void run();
+    void process(Batch & batch);
+    void answer(const protocol::RequestHeader & header, const char * args, std::vector<char> & responses);
+
+public:
+    WorkerPool(kdtree::PointSet & set, std::size_t threads, int wakeup);
+    ~WorkerPool();
+
+    void submit(Batch batch);
+    std::deque<Batch> take_done();
+};
+
+WorkerPool::WorkerPool(kdtree::PointSet & set, std::size_t threads, int wakeup)
+    : m_set(set)
+    , m_wakeup(wakeup)
+{
+    for (std::size_t i = 0; i < threads; ++i) {
+        m_threads.emplace_back([this] { run(); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopped = true;
+    }
+    m_ready.notify_all();
+    for (std::thread & thread : m_threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::submit(Batch batch)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_tasks.push_back(std::move(batch));
+    }
+    m_ready.notify_one();
+}
+
+std::deque<Batch> WorkerPool::take_done()
+{
+    std::lock_guard lock(m_mutex);
+    return std::exchange(m_done, {});
+}
+
+void WorkerPool::run()
+{
+    while (true) {
+        Batch batch;
+        {
+            std::unique_lock lock(m_mutex);
+            m_ready.wait(lock, [this] { return m_stopped || !m_tasks.empty(); });
+            if (m_stopped) {
+                return;
+            }
+            batch = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        process(batch);
+        {
+            std::lock_guard lock(m_mutex);
+            m_done.push_back(std::move(batch));
+        }
+        std::uint64_t one = 1;
+        [[maybe_unused]] ssize_t written = write(m_wakeup, &one, sizeof(one));
+    }
+}
+
+//requests are answered in order; a run of reads shares one shared lock and a run of puts one exclusive lock
+void WorkerPool::process(Batch & batch)
+{
+    std::shared_lock reading(m_set_mutex, std::defer_lock);
+    std::unique_lock writing(m_set_mutex, std::defer_lock);
+    const char * data = batch.requests.data();
+    const char * end = data + batch.requests.size();
+    protocol::RequestHeader header;
+    while (protocol::extract(data, end, header)) {
+        if (header.op == protocol::Op::put && !writing.owns_lock()) {
+            if (reading.owns_lock()) {
+                reading.unlock();
+            }
+            writing.lock();
+        }
+        else if (header.op != protocol::Op::put && !reading.owns_lock()) {
+            if (writing.owns_lock()) {
+                writing.unlock();
+            }
+            reading.lock();
+        }
+        answer(header, data, batch.responses);
+        data += header.length;
+    }
+}
+
+void WorkerPool::answer(const protocol::RequestHeader & header, const char * args, std::vector<char> & responses)
+{
+    std::size_t header_at = responses.size();
+    protocol::append(responses, protocol::ResponseHeader{0, header.id, protocol::Status::ok, {}});
+
+    const char * end = args + header.length;
+    double x, y, x_max, y_max;
+    std::uint32_t k;
+    bool point = protocol::extract(args, end, x) && protocol::extract(args, end, y);
+    bool valid = point;
+    switch (header.op) {
+    case protocol::Op::put:
+        if (valid) {
+            m_set.put(Point(x, y));
+        }
+        break;
+    case protocol::Op::contains:
+        if (valid) {
+            protocol::append(responses, std::uint8_t(m_set.contains(Point(x, y))));
+        }
+        break;
+    case protocol::Op::range:
+        valid = point && protocol::extract(args, end, x_max) && protocol::extract(args, end, y_max);
+        if (valid) {
+            auto [first, last] = m_set.range(Rect(Point(x, y), Point(x_max, y_max)));
+            protocol::append_points(responses, first, last);
+        }
+        break;
+    case protocol::Op::nearest:
+        if (valid) {
+            std::optional<Point> nearest = m_set.nearest(Point(x, y));
+            protocol::append_points(responses, nearest ? &*nearest : nullptr, nearest ? &*nearest + 1 : nullptr);
+        }
+        break;
+    case protocol::Op::knn:
+        valid = point && protocol::extract(args, end, k);
+        if (valid) {
+            auto [first, last] = m_set.nearest(Point(x, y), k);
+            protocol::append_points(responses, first, last);
+        }
+        break;
+    default:
+        valid = false;
+    }
+
+    protocol::ResponseHeader response{static_cast<std::uint32_t>(responses.size() - header_at - sizeof(protocol::ResponseHeader)), header.id, protocol::Status::ok, {}};
+    if (!valid) {
+        responses.resize(header_at + sizeof(protocol::ResponseHeader));
+        response.length = 0;
+        response.status = protocol::Status::bad_request;
+    }
+    std::memcpy(responses.data() + header_at, &response, sizeof(response));
+}
+
+// one thread owns all the sockets: it reads requests, hands them to the workers in batches and writes the answers back
+class Reactor
+{
+private:
+    struct Connection
+    {
+        int fd;
+        std::vector<char> in;
+        std::vector<char> out;
+        std::size_t written = 0;
+        // a batch of this connection is being answered, the next one waits for it to keep responses in order
+        bool busy = false;
+        bool closing = false;
+        bool writing = false;
+        // what the socket is registered for in epoll
+        std::uint32_t events = EPOLLIN | EPOLLRDHUP;
+    };
+
+    static constexpr std::uint64_t listener_id = 0;
+    static constexpr std::uint64_t wakeup_id = 1;
+    // a client pipelining faster than it is answered, or not reading its answers, waits in its own socket buffers
+    // instead of our memory: no batch is dispatched while this many bytes of answers are unsent,
+    // and the connection is not read while this many bytes of requests wait for a batch
+    static constexpr std::size_t max_buffered_output = 1 << 20;
+    static constexpr std::size_t max_buffered_input = 1 << 20;
+
+    int m_epoll;
+    int m_listener;
+    int m_wakeup;
+    std::unordered_map<std::uint64_t, Connection> m_connections;
+    std::uint64_t m_next_id = 2;
+    WorkerPool m_pool;
+
+    void watch(int fd, std::uint64_t id, std::uint32_t events, int op);
+    // registers the connection for the events its state calls for
+    void rearm(std::uint64_t id, Connection & connection);
+    void accept_all();
+    void read(std::uint64_t id, Connection & connection);
+    void flush(std::uint64_t id, Connection & connection);
+    void dispatch(std::uint64_t id, Connection & connection);
+    void finish();
+    void close(std::uint64_t id);
+
+public:
+    Reactor(const std::string & path, kdtree::PointSet & set, std::size_t threads);
+    ~Reactor();
+
+    void run();
+};
+
+Reactor::Reactor(const std::string & path, kdtree::PointSet & set, std::size_t threads)
+    : m_epoll(check(epoll_create1(EPOLL_CLOEXEC), "epoll_create1"))
+    , m_listener(check(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), "socket"))
+    , m_wakeup(check(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd"))
+    , m_pool(set, threads, m_wakeup)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("socket path is too long: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    unlink(path.c_str());
+    check(bind(m_listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)), "bind");
+    check(listen(m_listener, SOMAXCONN), "listen");
+    watch(m_listener, listener_id, EPOLLIN, EPOLL_CTL_ADD);
+    watch(m_wakeup, wakeup_id, EPOLLIN, EPOLL_CTL_ADD);
+}
+
+Reactor::~Reactor()
+{
+    for (auto & [id, connection] : m_connections) {
+        ::close(connection.fd);
+    }
+    ::close(m_listener);
+    ::close(m_wakeup);
+    ::close(m_epoll);
+}
+
+void Reactor::watch(int fd, std::uint64_t id, std::uint32_t events, int op)
+{
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = id;
+    check(epoll_ctl(m_epoll, op, fd, &event), "epoll_ctl");
+}
+
+//input only piles up while it can't be dispatched, and reading resumes once a finished batch or sent answers let it go
+void Reactor::rearm(std::uint64_t id, Connection & connection)
+{
+    bool paused = connection.in.size() >= max_buffered_input;
+    std::uint32_t events = (connection.closing || paused ? 0 : std::uint32_t(EPOLLIN | EPOLLRDHUP)) | (connection.writing ? std::uint32_t(EPOLLOUT) : 0);
+    if (events != connection.events) {
+        connection.events = events;
+        watch(connection.fd, id, events, EPOLL_CTL_MOD);
+    }
+}
+
+void Reactor::run()
+{
+    std::vector<epoll_event> events(256);
+    while (true) {
+        int count = epoll_wait(m_epoll, events.data(), static_cast<int>(events.size()), -1);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        check(count, "epoll_wait");
+        for (int i = 0; i < count; ++i) {
+            std::uint64_t id = events[i].data.u64;
+            if (id == listener_id) {
+                accept_all();
+                continue;
+            }
+            if (id == wakeup_id) {
+                finish();
+                continue;
+            }
+            auto found = m_connections.find(id);
+            if (found == m_connections.end()) {
+                continue;
+            }
+            //nobody is left to read the answers
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                close(id);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush(id, found->second);
+                found = m_connections.find(id);
+            }
+            if (found != m_connections.end() && (events[i].events & (EPOLLIN | EPOLLRDHUP))) {
+                read(id, found->second);
+            }
+        }
+    }
+}
+
+void Reactor::accept_all()
+{
+    while (true) {
+        int fd = accept4(m_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED) {
+                std::cerr << "accept: " << std::strerror(errno) << std::endl;
+            }
+            return;
+        }
+        std::uint64_t id = m_next_id++;
+        m_connections.emplace(id, Connection{fd, {}, {}});
+        watch(fd, id, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+    }
+}
+
+void Reactor::read(std::uint64_t id, Connection & connection)
+{
+    char buffer[1 << 16];
+    while (connection.in.size() < max_buffered_input) {
+        ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            connection.in.insert(connection.in.end(), buffer, buffer + received);
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        //the peer is gone, but the requests it has already sent are still answered if it only shut down writing
+        connection.closing = true;
+        if (received < 0) {
+            close(id);
+            return;
+        }
+        break;
+    }
+    dispatch(id, connection);
+    auto found = m_connections.find(id);
+    if (found != m_connections.end()) {
+        rearm(id, found->second);
+    }
+}
+
+void Reactor::dispatch(std::uint64_t id, Connection & connection)
+{
+    if (!connection.busy && connection.out.size() - connection.written < max_buffered_output) {
+        std::size_t complete = 0;
+        protocol::RequestHeader header;
+        while (true) {
+            const char * data = connection.in.data() + complete;
+            if (!protocol::extract(data, connection.in.data() + connection.in.size(), header)) {
+                break;
+            }
+            if (header.length > protocol::max_request_length) {
+                close(id);
+                return;
+            }
+            if (connection.in.size() - complete < sizeof(header) + header.length) {
+                break;
+            }
+            complete += sizeof(header) + header.length;
+        }
+        if (complete != 0) {
+            Batch batch{id, std::vector<char>(connection.in.begin(), connection.in.begin() + complete), {}};
+            connection.in.erase(connection.in.begin(), connection.in.begin() + complete);
+            connection.busy = true;
+            m_pool.submit(std::move(batch));
+        }
+    }
+    if (connection.closing && !connection.busy && connection.out.empty()) {
+        close(id);
+    }
+}
+
+void Reactor::flush(std::uint64_t id, Connection & connection)
+{
+    while (connection.written < connection.out.size()) {
+        ssize_t sent = send(connection.fd, connection.out.data() + connection.written, connection.out.size() - connection.written, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            close(id);
+            return;
+        }
+        connection.written += sent;
+    }
+    bool pending = connection.written < connection.out.size();
+    if (!pending) {
+        connection.out.clear();
+        connection.written = 0;
+    }
+    connection.writing = pending;
+    //a batch held back by unsent answers can go now
+    dispatch(id, connection);
+    auto found = m_connections.find(id);
+    if (found != m_connections.end()) {
+        rearm(id, found->second);
+    }
+}
+
+void Reactor::finish()
+{
+    std::uint64_t counter;
+    [[maybe_unused]] ssize_t received = ::read(m_wakeup, &counter, sizeof(counter));
+    for (Batch & batch : m_pool.take_done()) {
+        auto found = m_connections.find(batch.connection);
+        if (found == m_connections.end()) {
+            continue;
+        }
+        Connection & connection = found->second;
+        connection.busy = false;
+        connection.out.insert(connection.out.end(), batch.responses.begin(), batch.responses.end());
+        //requests that came in while the batch was being answered form the next one
+        flush(batch.connection, connection);
+    }
+}
+
+void Reactor::close(std::uint64_t id)
+{
+    auto found = m_connections.find(id);
+    ::close(found->second.fd);
+    m_connections.erase(found);
+}
+
+} // namespace server
+
+int main(int argc, char ** argv)
+{
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <socket path> <points file> [worker threads]" << std::endl;
+        return 1;
+    }
+    std::size_t threads = (argc > 3 ? std::stoul(argv[3]) : std::max(1U, std::thread::hardware_concurrency()));
+    std::signal(SIGPIPE, SIG_IGN);
+    try {
+        kdtree::PointSet set{std::string(argv[2])};
+        std::cout << "Loaded " << set.size() << " points, serving on " << argv[1] << std::endl;
+        server::Reactor reactor(argv[1], set, threads);
+        reactor.run();
+    }
+    catch (const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,134 @@
+#include "primitives.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+namespace split_cost {
+
+using clock = std::chrono::steady_clock;
+
+double milliseconds_since(clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+}
+
+//clustered like the fleet data: a few dense city centres, the rest scattered over the ocean
+std::vector<Point> sample(std::size_t count, unsigned seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> anywhere(0, 1000);
+    std::normal_distribution<double> around(0, 2);
+    std::vector<Point> centres;
+    for (int i = 0; i < 20; ++i) {
+        centres.emplace_back(anywhere(random), anywhere(random));
+    }
+    std::uniform_int_distribution<std::size_t> centre(0, centres.size() - 1);
+    std::vector<Point> points;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (i % 20 == 0) {
+            points.emplace_back(anywhere(random), anywhere(random));
+        }
+        else {
+            const Point & c = centres[centre(random)];
+            points.emplace_back(c.x() + around(random), c.y() + around(random));
+        }
+    }
+    return points;
+}
+
+std::vector<Point> load(const std::string & filename)
+{
+    std::ifstream file(filename);
+    if (!file.good()) {
+        throw std::runtime_error("can't read " + filename);
+    }
+    std::vector<Point> points;
+    double x, y;
+    while (file >> x >> y) {
+        points.emplace_back(x, y);
+    }
+    return points;
+}
+
+//the timed queries follow the data, as ours do: they are centred on points of the sample; the expected number
+//of boxes assumes queries placed uniformly over the bounds, which is what empty space costs
+template <typename Split>
+void report(const std::string & name, const std::vector<Point> & points, std::size_t leaf_size, double side, const std::vector<Point> & queries)
+{
+    clock::time_point start = clock::now();
+    kdtree::BasicPointSet<Split> set(points, leaf_size);
+    double build = milliseconds_since(start);
+
+    start = clock::now();
+    std::size_t found = 0;
+    for (const Point & q : queries) {
+        auto [first, last] = set.range(Rect(Point(q.x() - side / 2, q.y() - side / 2), Point(q.x() + side / 2, q.y() + side / 2)));
+        found += std::distance(first, last);
+    }
+    double range = milliseconds_since(start) * 1000 / queries.size();
+
+    start = clock::now();
+    for (const Point & q : queries) {
+        found += set.nearest(Point(q.x() + side, q.y() + side)).has_value();
+    }
+    double nearest = milliseconds_since(start) * 1000 / queries.size();
+
+    std::cout << std::left << std::setw(18) << name << std::right
+              << std::setw(6) << leaf_size
+              << std::setw(12) << build
+              << std::setw(14) << set.expected_cost(side, side)
+              << std::setw(14) << range
+              << std::setw(14) << nearest
+              << "  (" << found << ")" << std::endl;
+}
+
+//bigger leaves trade box checks for point checks, which pays off where the points are dense
+template <typename Split>
+void sweep(const std::string & name, const std::vector<Point> & points, double side, const std::vector<Point> & queries)
+{
+    for (std::size_t leaf_size : {1, 4, 16, 64}) {
+        report<Split>(name, points, leaf_size, side, queries);
+    }
+}
+
+} // namespace split_cost
+
+int main(int argc, char ** argv)
+{
+    std::vector<Point> points;
+    if (argc > 1 && std::string(argv[1]) != "-") {
+        points = split_cost::load(argv[1]);
+    }
+    else {
+        points = split_cost::sample(200000, 1);
+    }
+    if (points.empty()) {
+        std::cerr << "usage: " << argv[0] << " [points file or -] [query side]" << std::endl;
+        return 1;
+    }
+    kdtree::PointSet probe(points);
+    Rect bounds = *probe.bounds();
+    //by default a query covers a thousandth of the bounds on each side
+    double side = (argc > 2 ? std::stod(argv[2]) : std::max(bounds.xmax() - bounds.xmin(), bounds.ymax() - bounds.ymin()) / 1000);
+
+    std::mt19937 random(2);
+    std::uniform_int_distribution<std::size_t> pick(0, points.size() - 1);
+    std::vector<Point> queries;
+    for (int i = 0; i < 10000; ++i) {
+        queries.push_back(points[pick(random)]);
+    }
+
+    std::cout << points.size() << " points, query side " << side << '\n'
+              << std::left << std::setw(18) << "policy" << std::right
+              << std::setw(6) << "leaf"
+              << std::setw(12) << "build ms"
+              << std::setw(14) << "exp. boxes"
+              << std::setw(14) << "range us"
+              << std::setw(14) << "nearest us" << std::endl;
+    split_cost::sweep<kdtree::MedianSplit>("median", points, side, queries);
+    split_cost::sweep<kdtree::SlidingMidpointSplit>("sliding midpoint", points, side, queries);
+    split_cost::sweep<kdtree::WidestSpreadSplit>("widest spread", points, side, queries);
+    split_cost::sweep<kdtree::CostSplit>("cost", points, side, queries);
+}